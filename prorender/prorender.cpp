@@ -19,10 +19,19 @@
 #endif
 
 #include <prorender.hpp>
-
+#include <prorender_etc1.hpp>
+#include <prorender_swizzle.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
 #include <filesystem>
-#include <functional>
 #include <map>
+#include <mutex>
+#include <string_view>
+#include <unordered_map>
 
 #ifdef PRO_DEFINE_STB_IMAGE
 #if PRO_DEFINE_STB_IMAGE == 1
@@ -33,6 +42,9 @@
 
 #include <stb_image.h>
 
+using ProRender::Swizzle::SwizzleImage;
+using ProRender::Swizzle::SwizzleRect;
+
 /// Lookup Table for Hex colors
 static const std::map<char, int> LOOKUP_HEX_COLOR = {
     {'0', 0},  {'1', 1},  {'2', 2},  {'3', 3},  {'4', 4},  {'5', 5},
@@ -52,30 +64,549 @@ static unsigned int GetPower2(unsigned int v) {
   return (v >= 64 ? v : 64);
 }
 
-static void ConvertImage(C3D_Tex *tex, Tex3DS_SubTexture *subtex,
-                         unsigned char *buf, unsigned int size,
-                         unsigned int width, unsigned int height,
-                         GPU_TEXCOLOR format) {
-  // RGBA -> ABGR
-  for (unsigned int row = 0; row < width; row++) {
-    for (unsigned int col = 0; col < height; col++) {
-      unsigned int z = (row + col * width) * 4;
+/// Bits per texel of a GPU texture format
+static unsigned int TexFormatBits(GPU_TEXCOLOR format) {
+  switch (format) {
+  case GPU_RGBA8:
+    return 32;
+  case GPU_RGB8:
+    return 24;
+  case GPU_RGBA5551:
+  case GPU_RGB565:
+  case GPU_RGBA4:
+  case GPU_LA8:
+  case GPU_HILO8:
+    return 16;
+  case GPU_L4:
+  case GPU_A4:
+  case GPU_ETC1:
+    return 4;
+  default:
+    return 8;
+  }
+}
+
+/// SubTexture of a loaded image. Also remembers the transparent margins
+/// cut off by ImageOptions::trim_alpha, so draws can put the rest in place.
+struct ImageSubTexture : Tex3DS_SubTexture {
+  u16 trim_left = 0;
+  u16 trim_top = 0;
+  u16 trim_right = 0;
+  u16 trim_bottom = 0;
+};
+
+struct BatchLoad;
+struct ImageStage;
+static bool RequestBatchTexture(BatchLoad *batch, ImageStage *stage,
+                                bool release);
+
+/// Texture data on its way to the GPU. With `tex` set everything is written
+/// straight into the texture, otherwise into `buffer`, which lets the work
+/// run off the render thread and get uploaded later by UploadStage().
+struct ImageStage {
+  ImageStage() = default;
+  ImageStage(const ImageStage &) = delete;
+  ImageStage &operator=(const ImageStage &) = delete;
+  ~ImageStage() { free(buffer); }
+
+  C3D_Tex *tex = nullptr;
+  unsigned char *buffer = nullptr;
+  GPU_TEXCOLOR format = GPU_RGBA8;
+  u16 width = 0;
+  u16 height = 0;
+  u8 max_level = 0; //< Number of mip levels below the full size one
+  ImageSubTexture subtex;
+  /// Set on LoadImageFiles() helper threads, `tex` is then allocated and
+  /// freed by the thread that started the batch
+  BatchLoad *batch = nullptr;
+
+  unsigned char *Alloc(GPU_TEXCOLOR fmt, u16 w, u16 h, u8 levels = 0) {
+    format = fmt;
+    width = w;
+    height = h;
+    max_level = levels;
+    if (tex) {
+      bool ok = batch ? RequestBatchTexture(batch, this, false) : InitTexture();
+      return ok ? (unsigned char *)tex->data : nullptr;
+    }
+    // Plain malloc so running out of memory fails the load instead of
+    // aborting, the same as a failed texture allocation
+    free(buffer);
+    buffer = (unsigned char *)malloc(Size());
+    return buffer;
+  }
+
+  void Free() {
+    if (tex && tex->data) {
+      if (batch)
+        RequestBatchTexture(batch, this, true);
+      else
+        DeleteTexture();
+    }
+    free(buffer);
+    buffer = nullptr;
+  }
+
+  bool InitTexture() {
+    return max_level ? C3D_TexInitMipmap(tex, width, height, format)
+                     : C3D_TexInit(tex, width, height, format);
+  }
+
+  void DeleteTexture() {
+    C3D_TexDelete(tex);
+    tex->data = nullptr;
+  }
+
+  unsigned char *Data() {
+    return tex ? (unsigned char *)tex->data : buffer;
+  }
+
+  unsigned int Size() const {
+    unsigned int size = (unsigned int)width * height;
+    return C3D_TexCalcTotalSize(size * TexFormatBits(format) / 8, max_level);
+  }
+};
+
+/// Check a decoded RGBA image against the maximum texture size, frees it
+/// if it does not fit
+static bool CheckDecodedImage(unsigned char *buffer, int w, int h) {
+  if (!buffer)
+    return false;
+
+  if (w > 1024 || h > 1024) {
+
+    stbi_image_free(buffer);
+    return false;
+  }
+  return true;
+}
+
+/// Decoding
+/// What an image gets decoded for. A texture keeps the source channel count
+/// and max_size is capped to the texture limit. LargeImage and TextureAtlas
+/// split or pack RGBA8 pixels themselves.
+enum DecodeTarget { DecodeForTexture, DecodeForRGBA };
+
+/// Integer factor that makes a w x h image fit `opts.max_size`
+static unsigned int GetDownscaleFactor(int w, int h,
+                                       const ProRender::ImageOptions &opts,
+                                       DecodeTarget target) {
+  if (!opts.max_size || w <= 0 || h <= 0)
+    return 1;
+  unsigned int limit = opts.max_size;
+  if (target == DecodeForTexture)
+    limit = std::min(limit, 1024u);
+  unsigned int size = (unsigned int)std::max(w, h);
+  return std::max(1u, (size + limit - 1) / limit);
+}
+
+/// Channels to decode with. The source channel count keeps the full size
+/// buffer small, ConvertImage() expands it strip by strip. The downscaler
+/// needs room for its RGBA result and ETC1 wants the whole RGBA image.
+static int GetDecodeChannels(int channels, unsigned int factor,
+                             const ProRender::ImageOptions &opts,
+                             DecodeTarget target) {
+  bool etc1 = !opts.auto_format &&
+              (opts.format == GPU_ETC1 || opts.format == GPU_ETC1A4);
+  if (target == DecodeForRGBA || etc1 || channels < 1 || channels > 4)
+    return 4;
+  if (factor > 1 && factor * (unsigned int)channels < 4)
+    return 4;
+  return channels;
+}
+
+/// Box filter an image with `channels` bytes per pixel down by `factor`
+/// into an RGBA8 image at the start of the same buffer. Color is weighted
+/// by alpha so transparent pixels do not darken the edges.
+static void DownscaleImage(unsigned char *buf, unsigned int width,
+                           unsigned int height, unsigned int channels,
+                           unsigned int factor, unsigned int *out_w,
+                           unsigned int *out_h) {
+  unsigned int ow = (width + factor - 1) / factor;
+  unsigned int oh = (height + factor - 1) / factor;
+  unsigned int pitch = width * channels;
+  unsigned char *out = buf;
+
+  for (unsigned int oy = 0; oy < oh; oy++) {
+    unsigned int y0 = oy * factor, y1 = std::min(height, y0 + factor);
+    for (unsigned int ox = 0; ox < ow; ox++) {
+      unsigned int x0 = ox * factor, x1 = std::min(width, x0 + factor);
+      u64 sum[3] = {0, 0, 0}, alpha = 0, count = 0;
+      for (unsigned int y = y0; y < y1; y++) {
+        const unsigned char *p = buf + y * pitch + x0 * channels;
+        for (unsigned int x = x0; x < x1; x++, p += channels) {
+          unsigned int a = (channels == 2 || channels == 4) ? p[channels - 1]
+                                                            : 255;
+          sum[0] += p[0] * a;
+          if (channels >= 3) {
+            sum[1] += p[1] * a;
+            sum[2] += p[2] * a;
+          }
+          alpha += a;
+          count++;
+        }
+      }
+      if (channels < 3)
+        sum[1] = sum[2] = sum[0];
+      for (int i = 0; i < 3; i++)
+        out[i] = alpha ? (unsigned char)((sum[i] + alpha / 2) / alpha) : 0;
+      out[3] = (unsigned char)((alpha + count / 2) / count);
+      out += 4;
+    }
+  }
+  *out_w = ow;
+  *out_h = oh;
+}
+
+/// Shrink a freshly decoded image if a factor was picked for it, updates
+/// `channels` to the channel count of the result
+static unsigned char *FinishDecode(unsigned char *buffer, int *w, int *h,
+                                   int *channels, unsigned int factor) {
+  if (buffer && factor > 1) {
+    unsigned int ow, oh;
+    DownscaleImage(buffer, (unsigned int)*w, (unsigned int)*h,
+                   (unsigned int)*channels, factor, &ow, &oh);
+    *w = (int)ow;
+    *h = (int)oh;
+    *channels = 4;
+  }
+  return buffer;
+}
+
+/// Decode an image file, shrunk to `opts.max_size` if set. `channels` gets
+/// the bytes per pixel of the returned buffer.
+static unsigned char *
+DecodeImageFile(const std::string &path, const ProRender::ImageOptions &opts,
+                int *w, int *h, int *c, int *channels,
+                DecodeTarget target = DecodeForTexture) {
+  FILE *f = fopen(path.c_str(), "rb");
+  if (!f)
+    return nullptr;
+  unsigned int factor = 1;
+  *channels = 4;
+  // stbi_info_from_file seeks back, the header is only read once more
+  if (stbi_info_from_file(f, w, h, c)) {
+    factor = GetDownscaleFactor(*w, *h, opts, target);
+    *channels = GetDecodeChannels(*c, factor, opts, target);
+  }
+  unsigned char *buffer =
+      (unsigned char *)stbi_load_from_file(f, w, h, c, *channels);
+  fclose(f);
+  return FinishDecode(buffer, w, h, channels, factor);
+}
+
+/// Decode an image in memory, shrunk to `opts.max_size` if set. `channels`
+/// gets the bytes per pixel of the returned buffer.
+static unsigned char *
+DecodeImageMemory(ProRender::BufferView file_buffer,
+                  const ProRender::ImageOptions &opts, int *w, int *h, int *c,
+                  int *channels, DecodeTarget target = DecodeForTexture) {
+  unsigned int factor = 1;
+  *channels = 4;
+  if (stbi_info_from_memory(file_buffer.data, (int)file_buffer.size, w, h,
+                            c)) {
+    factor = GetDownscaleFactor(*w, *h, opts, target);
+    *channels = GetDecodeChannels(*c, factor, opts, target);
+  }
+  unsigned char *buffer = (unsigned char *)stbi_load_from_memory(
+      file_buffer.data, (int)file_buffer.size, w, h, c, *channels);
+  return FinishDecode(buffer, w, h, channels, factor);
+}
+
+/// FormatConversion
+/// Bit depth and position of r, g, b, a in a packed 16 bit texel
+struct PackedFormat {
+  unsigned char bits[4];
+  unsigned char shift[4];
+};
+
+static bool GetPackedFormat(GPU_TEXCOLOR format, PackedFormat *out) {
+  switch (format) {
+  case GPU_RGB565:
+    *out = {{5, 6, 5, 0}, {11, 5, 0, 0}};
+    return true;
+  case GPU_RGBA5551:
+    *out = {{5, 5, 5, 1}, {11, 6, 1, 0}};
+    return true;
+  case GPU_RGBA4:
+    *out = {{4, 4, 4, 4}, {12, 8, 4, 0}};
+    return true;
+  default:
+    return false;
+  }
+}
+
+/// 4x4 Bayer matrix for ordered dithering
+static const unsigned char BAYER4[4][4] = {
+    {0, 8, 2, 10}, {12, 4, 14, 6}, {3, 11, 1, 9}, {15, 7, 13, 5}};
+
+static inline int ClampByte(int v) { return v < 0 ? 0 : (v > 255 ? 255 : v); }
+
+/// Floyd-Steinberg error of the current and next row, scaled by 16. Kept
+/// across calls so an image can be converted in strips.
+struct DitherState {
+  std::vector<int> err_cur, err_next;
+};
+
+/// Pack RGBA8 pixels into a 16 bit format. Only the color channels get
+/// dithered, dithered alpha just makes edges sparkle.
+/// Packs rows y0 .. y0 + height - 1 of an image in place.
+static void PackPixels16(unsigned char *buf, unsigned int width,
+                         unsigned int height, const PackedFormat &fmt,
+                         ProRender::ImageDither dither, unsigned int y0,
+                         DitherState *state) {
+  int max[4];
+  for (int i = 0; i < 4; i++)
+    max[i] = (1 << fmt.bits[i]) - 1;
+
+  DitherState local;
+  if (!state)
+    state = &local;
+  std::vector<int> &err_cur = state->err_cur, &err_next = state->err_next;
+  if (dither == ProRender::DitherFloydSteinberg &&
+      err_cur.size() != (width + 2) * 3) {
+    err_cur.assign((width + 2) * 3, 0);
+    err_next.assign((width + 2) * 3, 0);
+  }
+
+  const unsigned char *src = buf;
+  u16 *dst = (u16 *)buf;
+  for (unsigned int y = 0; y < height; y++) {
+    for (unsigned int x = 0; x < width; x++, src += 4) {
+      u16 texel = 0;
+      for (int i = 0; i < 3; i++) {
+        int v = src[i];
+        if (dither == ProRender::DitherOrdered) {
+          v += ((int)BAYER4[(y0 + y) & 3][x & 3] * 2 - 15) * 255 /
+               (max[i] * 32);
+        } else if (dither == ProRender::DitherFloydSteinberg) {
+          v += err_cur[(x + 1) * 3 + i] / 16;
+        }
+        v = ClampByte(v);
+        int q = (v * max[i] + 127) / 255;
+        if (dither == ProRender::DitherFloydSteinberg) {
+          int e = v - q * 255 / max[i];
+          err_cur[(x + 2) * 3 + i] += e * 7;
+          err_next[x * 3 + i] += e * 3;
+          err_next[(x + 1) * 3 + i] += e * 5;
+          err_next[(x + 2) * 3 + i] += e;
+        }
+        texel |= (u16)(q << fmt.shift[i]);
+      }
+      if (max[3])
+        texel |= (u16)(((src[3] * max[3] + 127) / 255) << fmt.shift[3]);
+      // Written behind the read position, so this works in place
+      dst[y * width + x] = texel;
+    }
+    if (dither == ProRender::DitherFloydSteinberg) {
+      err_cur.swap(err_next);
+      std::fill(err_next.begin(), err_next.end(), 0);
+    }
+  }
+}
+
+/// Convert RGBA8 pixels in place to `format`, returns the new pixel size or
+/// 0 if the format is not supported. For strips `y0` is the first row and
+/// `state` carries the dithering error over to the next strip.
+static unsigned int ConvertPixels(unsigned char *buf, unsigned int width,
+                                  unsigned int height, GPU_TEXCOLOR format,
+                                  ProRender::ImageDither dither,
+                                  unsigned int y0 = 0,
+                                  DitherState *state = nullptr) {
+  unsigned int pixels = width * height;
+  PackedFormat packed;
+  if (GetPackedFormat(format, &packed)) {
+    PackPixels16(buf, width, height, packed, dither, y0, state);
+    return 2;
+  }
+
+  switch (format) {
+  case GPU_RGBA8:
+  case GPU_ETC1:
+  case GPU_ETC1A4:
+    return 4;
+  case GPU_RGB8:
+    for (unsigned int i = 0; i < pixels; i++)
+      memmove(buf + i * 3, buf + i * 4, 3);
+    return 3;
+  case GPU_LA8:
+    for (unsigned int i = 0; i < pixels; i++) {
+      const unsigned char *p = buf + i * 4;
+      unsigned int l = (p[0] * 77 + p[1] * 150 + p[2] * 29) >> 8;
+      u16 texel = (u16)(l << 8 | p[3]);
+      memcpy(buf + i * 2, &texel, 2);
+    }
+    return 2;
+  case GPU_L8:
+    for (unsigned int i = 0; i < pixels; i++) {
+      const unsigned char *p = buf + i * 4;
+      buf[i] = (unsigned char)((p[0] * 77 + p[1] * 150 + p[2] * 29) >> 8);
+    }
+    return 1;
+  case GPU_A8:
+    for (unsigned int i = 0; i < pixels; i++)
+      buf[i] = buf[i * 4 + 3];
+    return 1;
+  default:
+    return 0;
+  }
+}
+
+/// Expand gray, gray+alpha or RGB pixels to RGBA8
+static void ExpandToRGBA(unsigned char *dst, const unsigned char *src,
+                         unsigned int pixels, unsigned int channels) {
+  switch (channels) {
+  case 1:
+    for (unsigned int i = 0; i < pixels; i++, dst += 4) {
+      dst[0] = dst[1] = dst[2] = src[i];
+      dst[3] = 255;
+    }
+    break;
+  case 2:
+    for (unsigned int i = 0; i < pixels; i++, src += 2, dst += 4) {
+      dst[0] = dst[1] = dst[2] = src[0];
+      dst[3] = src[1];
+    }
+    break;
+  case 3:
+    for (unsigned int i = 0; i < pixels; i++, src += 3, dst += 4) {
+      dst[0] = src[0];
+      dst[1] = src[1];
+      dst[2] = src[2];
+      dst[3] = 255;
+    }
+    break;
+  }
+}
+
+/// Smallest format that keeps the image intact enough: grayscale goes to
+/// L8/LA8, opaque color to RGB565 and 1 bit alpha to RGBA5551. Smooth alpha
+/// stays RGBA8, RGBA4 has to be asked for explicitly. `stride` is the bytes
+/// per pixel of `buf`, alpha is the last one if there is any.
+static GPU_TEXCOLOR PickImageFormat(const unsigned char *buf,
+                                    unsigned int pixels, int channels,
+                                    unsigned int stride = 4) {
+  bool opaque = true, binary_alpha = true;
+  for (unsigned int i = 0; i < pixels && (stride == 2 || stride == 4); i++) {
+    unsigned char a = buf[i * stride + stride - 1];
+    if (a != 255) {
+      opaque = false;
+      if (a != 0) {
+        binary_alpha = false;
+        break;
+      }
+    }
+  }
+
+  if (channels <= 2)
+    return opaque ? GPU_L8 : GPU_LA8;
+  if (opaque)
+    return GPU_RGB565;
+  if (binary_alpha)
+    return GPU_RGBA5551;
+  return GPU_RGBA8;
+}
+
+/// Convert pixels with `channels` bytes each to `format` and swizzle them
+/// to `dst` 8 rows at a time, while they are still in cache. RGBA8 input is
+/// converted in place unless `keep_source` is set, anything else goes
+/// through a strip sized buffer.
+static void ConvertStrips(unsigned char *dst, unsigned char *buf,
+                          unsigned int channels, unsigned int width,
+                          unsigned int height, unsigned int w_pow2,
+                          GPU_TEXCOLOR format, ProRender::ImageDither dither,
+                          bool keep_source = false) {
+  std::vector<unsigned char> strip;
+  if (channels != 4 || keep_source)
+    strip.resize(width * 8 * 4);
+  DitherState state;
+
+  for (unsigned int y = 0; y < height; y += 8) {
+    unsigned int rows = std::min(8u, height - y);
+    unsigned char *pixels = buf + y * width * channels;
+    if (channels != 4) {
+      ExpandToRGBA(strip.data(), pixels, width * rows, channels);
+      pixels = strip.data();
+    } else if (keep_source) {
+      memcpy(strip.data(), pixels, width * rows * 4);
+      pixels = strip.data();
+    }
+    unsigned int pixel_size =
+        ConvertPixels(pixels, width, rows, format, dither, y, &state);
+    SwizzleImage(pixel_size, dst + y * w_pow2 * pixel_size, pixels, width,
+                 rows, w_pow2);
+  }
+}
+
+/// Average 2x2 blocks of an RGBA8 image into the start of the same buffer,
+/// giving the next mip level. Plain byte sums the compiler can vectorize.
+static void HalveImage(unsigned char *buf, unsigned int width,
+                       unsigned int height) {
+  unsigned int pitch = width * 4;
+  unsigned char *out = buf;
+  for (unsigned int y = 0; y < height / 2; y++) {
+    const unsigned char *r0 = buf + y * 2 * pitch, *r1 = r0 + pitch;
+    for (unsigned int i = 0; i < width * 2; i++) {
+      unsigned int x = (i & ~3u) * 2 + (i & 3);
+      unsigned int sum = r0[x] + r0[x + 4] + r1[x] + r1[x + 4];
+      *out++ = (unsigned char)((sum + 2) >> 2);
+    }
+  }
+}
 
-      unsigned char r = *(unsigned char *)(buf + z);
-      unsigned char g = *(unsigned char *)(buf + z + 1);
-      unsigned char b = *(unsigned char *)(buf + z + 2);
-      unsigned char a = *(unsigned char *)(buf + z + 3);
+/// Fill a whole mip chain at `dst`. Level 0 gets the image edges repeated
+/// into the power of 2 padding, so linear filtering and the smaller levels
+/// do not blend in a black border.
+static void ConvertMipmaps(unsigned char *dst, const unsigned char *buf,
+                           unsigned int channels, unsigned int width,
+                           unsigned int height, unsigned int w_pow2,
+                           unsigned int h_pow2, unsigned int levels,
+                           GPU_TEXCOLOR format,
+                           const ProRender::ImageOptions &opts) {
+  std::vector<unsigned char> canvas(w_pow2 * h_pow2 * 4);
+  for (unsigned int y = 0; y < h_pow2; y++) {
+    unsigned char *row = &canvas[y * w_pow2 * 4];
+    if (y >= height) {
+      memcpy(row, row - w_pow2 * 4, w_pow2 * 4);
+      continue;
+    }
+    if (channels == 4)
+      memcpy(row, buf + y * width * 4, width * 4);
+    else
+      ExpandToRGBA(row, buf + y * width * channels, width, channels);
+    for (unsigned int x = width; x < w_pow2; x++)
+      memcpy(row + x * 4, row + (width - 1) * 4, 4);
+  }
 
-      *(buf + z) = a;
-      *(buf + z + 1) = b;
-      *(buf + z + 2) = g;
-      *(buf + z + 3) = r;
+  for (unsigned int level = 0;; level++) {
+    unsigned int lw = w_pow2 >> level, lh = h_pow2 >> level;
+    if (format == GPU_ETC1 || format == GPU_ETC1A4) {
+      ProRender::ETC1::Compress(dst, canvas.data(), lw, lh, lw, lh,
+                                format == GPU_ETC1A4,
+                                opts.etc1_high_quality ? ProRender::ETC1::High
+                                                       : ProRender::ETC1::Fast);
+    } else {
+      ConvertStrips(dst, canvas.data(), 4, lw, lh, lw, format, opts.dither,
+                    true);
     }
+    dst += lw * lh * TexFormatBits(format) / 8;
+    if (level == levels)
+      break;
+    HalveImage(canvas.data(), lw, lh);
   }
+}
 
+/// Convert decoded pixels with `channels` bytes each to `format` and
+/// swizzle them into the stage. Works on strips of 8 rows so only one
+/// strip of RGBA8 scratch is needed on top of the decoded image.
+static bool ConvertImage(ImageStage *stage, unsigned char *buf,
+                         unsigned int channels, unsigned int width,
+                         unsigned int height, GPU_TEXCOLOR format,
+                         const ProRender::ImageOptions &opts) {
   unsigned int w_pow2 = GetPower2(width);
   unsigned int h_pow2 = GetPower2(height);
 
+  Tex3DS_SubTexture *subtex = &stage->subtex;
   subtex->width = (u16)width;
   subtex->height = (u16)height;
   subtex->left = 0.0f;
@@ -83,77 +614,709 @@ static void ConvertImage(C3D_Tex *tex, Tex3DS_SubTexture *subtex,
   subtex->right = (width / (float)w_pow2);
   subtex->bottom = 1.0 - (height / (float)h_pow2);
 
-  C3D_TexInit(tex, (u16)w_pow2, (u16)h_pow2, format);
-  C3D_TexSetFilter(tex, GPU_NEAREST, GPU_NEAREST);
+  u8 levels = opts.mipmaps ? (u8)C3D_TexCalcMaxLevel(w_pow2, h_pow2) : 0;
+  unsigned char *dst = stage->Alloc(format, (u16)w_pow2, (u16)h_pow2, levels);
+  if (!dst)
+    return false;
 
-  unsigned int pixel_size = (size / width / height);
+  if (levels) {
+    ConvertMipmaps(dst, buf, channels, width, height, w_pow2, h_pow2, levels,
+                   format, opts);
+    return true;
+  }
 
-  memset(tex->data, 0, tex->size);
+  if (format == GPU_ETC1 || format == GPU_ETC1A4) {
+    // Compressed formats take the RGBA8 image as is
+    ProRender::ETC1::Compress(
+        dst, buf, width, height, w_pow2, h_pow2, format == GPU_ETC1A4,
+        opts.etc1_high_quality ? ProRender::ETC1::High : ProRender::ETC1::Fast);
+    return true;
+  }
 
-  for (unsigned int x = 0; x < width; x++) {
-    for (unsigned int y = 0; y < height; y++) {
-      unsigned int dst_pos =
-          ((((y >> 3) * (w_pow2 >> 3) + (x >> 3)) << 6) +
-           ((x & 1) | ((y & 1) << 1) | ((x & 2) << 1) | ((y & 2) << 2) |
-            ((x & 4) << 2) | ((y & 4) << 3))) *
-          pixel_size;
-      unsigned int src_pos = (y * width + x) * pixel_size;
+  memset(dst, 0, stage->Size());
+  ConvertStrips(dst, buf, channels, width, height, w_pow2, format,
+                opts.dither);
+  return true;
+}
 
-      memcpy(&((unsigned char *)tex->data)[dst_pos],
-             &((unsigned char *)buf)[src_pos], pixel_size);
-    }
+/// Texture parameters shared by every loaded image
+static void FinalizeTexture(C3D_Tex *tex) {
+  if (tex->maxLevel) {
+    // Mipmapped images are meant to be drawn scaled, filter trilinear
+    C3D_TexSetFilter(tex, GPU_LINEAR, GPU_LINEAR);
+    C3D_TexSetFilterMipmap(tex, GPU_LINEAR);
+  } else {
+    C3D_TexSetFilter(tex, GPU_NEAREST, GPU_NEAREST);
   }
-
   C3D_TexFlush(tex);
 
   tex->border = 0x00000000;
   C3D_TexSetWrap(tex, GPU_CLAMP_TO_BORDER, GPU_CLAMP_TO_BORDER);
-  linearFree(buf);
 }
 
-static C2D_Image privLoadImageFile(std::string path) {
+/// Flush only the tile rows of a texture that cover rows y0 .. y1 - 1
+static void FlushTextureRows(C3D_Tex *tex, unsigned int y0, unsigned int y1) {
+  unsigned int row_bytes = tex->width * 8 * TexFormatBits(tex->fmt) / 8;
+  unsigned int start = (y0 >> 3) * row_bytes;
+  unsigned int end =
+      std::min((unsigned int)tex->size, ((y1 + 7) >> 3) * row_bytes);
+  if (end > start)
+    GSPGPU_FlushDataCache((unsigned char *)tex->data + start, end - start);
+}
+
+/// Flush only the tiles of a texture that cover the rect x0 .. x1 - 1,
+/// y0 .. y1 - 1, one range per tile row
+static void FlushTextureRect(C3D_Tex *tex, unsigned int x0, unsigned int y0,
+                             unsigned int x1, unsigned int y1) {
+  unsigned int tile_bytes = 64 * TexFormatBits(tex->fmt) / 8;
+  unsigned int row_bytes = tex->width / 8 * tile_bytes;
+  unsigned int start = (x0 >> 3) * tile_bytes;
+  unsigned int len = ((x1 + 7) >> 3) * tile_bytes - start;
+  if (len >= row_bytes) {
+    FlushTextureRows(tex, y0, y1);
+    return;
+  }
+  for (unsigned int ty = y0 >> 3; ty < (y1 + 7) >> 3; ty++)
+    GSPGPU_FlushDataCache((unsigned char *)tex->data + ty * row_bytes + start,
+                          len);
+}
+
+/// Hand a finished stage over to the GPU. Render thread only.
+static C2D_Image UploadStage(ImageStage *stage) {
   C2D_Image img;
-  int w, h, c;
-  unsigned char *buffer =
-      (unsigned char *)stbi_load(path.c_str(), &w, &h, &c, 4);
+  C3D_Tex *tex = stage->tex;
+  if (!tex) {
+    tex = new C3D_Tex;
+    bool ok = stage->max_level
+                  ? C3D_TexInitMipmap(tex, stage->width, stage->height,
+                                      stage->format)
+                  : C3D_TexInit(tex, stage->width, stage->height,
+                                stage->format);
+    if (!ok) {
+      delete tex;
+      return C2D_Image();
+    }
+    memcpy(tex->data, stage->buffer, stage->Size());
+    stage->Free();
+  }
+  FinalizeTexture(tex);
+  img.tex = tex;
+  img.subtex = new ImageSubTexture(stage->subtex);
+  return img;
+}
 
-  if (w > 1024 || h > 1024) {
+/// TextureCache
+/// Cached textures are stored already tiled and channel swapped, so a cache
+/// hit is one header read plus one read straight into the texture.
+static std::string pr_image_cache_dir;
+
+/// Header of a cache blob, followed by `size` bytes of texture data
+struct TexCacheHeader {
+  char magic[4];
+  u32 version;
+  u64 key;
+  u32 format;
+  u32 size;
+  u16 width;
+  u16 height;
+  u32 max_level;
+  ImageSubTexture subtex;
+};
 
-    stbi_image_free(buffer);
-    return C2D_Image();
+static const char TEX_CACHE_MAGIC[4] = {'P', 'R', 'T', 'C'};
+static const u32 TEX_CACHE_VERSION = 3;
+
+/// FNV-1a 64
+static u64 HashBytes(const void *data, size_t len,
+                     u64 hash = 0xcbf29ce484222325ULL) {
+  const unsigned char *p = (const unsigned char *)data;
+  for (size_t i = 0; i < len; i++) {
+    hash ^= p[i];
+    hash *= 0x100000001b3ULL;
   }
+  return hash;
+}
 
-  C3D_Tex *tex = new C3D_Tex;
-  Tex3DS_SubTexture *subtex = new Tex3DS_SubTexture;
-  ConvertImage(tex, subtex, buffer, (unsigned int)(w * h * 4), (unsigned int)w,
-               (unsigned int)h, GPU_RGBA8);
-  img.tex = tex;
-  img.subtex = subtex;
+static u64 HashImageOptions(const ProRender::ImageOptions &opts, u64 hash) {
+  u32 conv[7] = {(u32)opts.format,   (u32)opts.auto_format,
+                 (u32)opts.dither,   (u32)opts.etc1_high_quality,
+                 (u32)opts.max_size, (u32)opts.mipmaps,
+                 (u32)opts.trim_alpha};
+  return HashBytes(conv, sizeof(conv), hash);
+}
+
+/// Cache key of an image file, changes whenever the file gets replaced
+static bool GetTexCacheKey(const std::string &path,
+                           const ProRender::ImageOptions &opts, u64 *key) {
+  std::error_code ec;
+  u64 file_size = (u64)std::filesystem::file_size(path, ec);
+  if (ec)
+    return false;
+  auto mtime = std::filesystem::last_write_time(path, ec)
+                   .time_since_epoch()
+                   .count();
+  if (ec)
+    return false;
+  u64 hash = HashBytes(path.data(), path.size());
+  hash = HashBytes(&file_size, sizeof(file_size), hash);
+  hash = HashBytes(&mtime, sizeof(mtime), hash);
+  *key = HashImageOptions(opts, hash);
+  return true;
+}
+
+static std::string GetTexCachePath(const std::string &dir, u64 key) {
+  char name[32];
+  snprintf(name, sizeof(name), "%016llx.prc", (unsigned long long)key);
+  return dir + "/" + name;
+}
+
+static bool ReadTexCache(const std::string &dir, u64 key, ImageStage *stage) {
+  FILE *f = fopen(GetTexCachePath(dir, key).c_str(), "rb");
+  if (!f)
+    return false;
+  TexCacheHeader hdr;
+  if (fread(&hdr, sizeof(hdr), 1, f) != 1 ||
+      memcmp(hdr.magic, TEX_CACHE_MAGIC, 4) != 0 ||
+      hdr.version != TEX_CACHE_VERSION || hdr.key != key) {
+    fclose(f);
+    return false;
+  }
+  unsigned char *dst =
+      stage->Alloc((GPU_TEXCOLOR)hdr.format, hdr.width, hdr.height,
+                   (u8)hdr.max_level);
+  if (!dst) {
+    fclose(f);
+    return false;
+  }
+  if (stage->Size() != hdr.size || fread(dst, hdr.size, 1, f) != 1) {
+    fclose(f);
+    stage->Free();
+    return false;
+  }
+  fclose(f);
+  stage->subtex = hdr.subtex;
+  return true;
+}
+
+static void WriteTexCache(const std::string &dir, u64 key, ImageStage *stage) {
+  TexCacheHeader hdr;
+  memcpy(hdr.magic, TEX_CACHE_MAGIC, 4);
+  hdr.version = TEX_CACHE_VERSION;
+  hdr.key = key;
+  hdr.format = (u32)stage->format;
+  hdr.size = stage->Size();
+  hdr.width = stage->width;
+  hdr.height = stage->height;
+  hdr.max_level = stage->max_level;
+  hdr.subtex = stage->subtex;
+
+  // Write to a temp file first so a crash never leaves a broken blob, the
+  // counter keeps parallel loads of the same file from sharing it
+  static std::atomic<unsigned int> tmp_counter(0);
+  std::string path = GetTexCachePath(dir, key);
+  std::string tmp = path + "." + std::to_string(tmp_counter++) + ".tmp";
+  FILE *f = fopen(tmp.c_str(), "wb");
+  if (!f)
+    return;
+  bool ok = fwrite(&hdr, sizeof(hdr), 1, f) == 1 &&
+            fwrite(stage->Data(), hdr.size, 1, f) == 1;
+  fclose(f);
+  std::error_code ec;
+  if (ok)
+    std::filesystem::rename(tmp, path, ec);
+  if (!ok || ec)
+    std::filesystem::remove(tmp, ec);
+}
+
+/// Crop the fully transparent margins of a decoded image in place. Images
+/// without alpha or without any visible pixel are left alone.
+static void TrimImage(unsigned char *buf, int *w, int *h, int channels,
+                      ImageSubTexture *subtex) {
+  if (channels != 2 && channels != 4)
+    return;
+  unsigned int width = (unsigned int)*w, height = (unsigned int)*h;
+  unsigned int x0 = width, y0 = height, x1 = 0, y1 = 0;
+  for (unsigned int y = 0; y < height; y++) {
+    const unsigned char *a = buf + y * width * channels + channels - 1;
+    for (unsigned int x = 0; x < width; x++, a += channels) {
+      if (*a) {
+        x0 = std::min(x0, x);
+        x1 = std::max(x1, x + 1);
+        y0 = std::min(y0, y);
+        y1 = y + 1;
+      }
+    }
+  }
+  if (x0 >= x1)
+    return;
+
+  unsigned int tw = x1 - x0, th = y1 - y0;
+  for (unsigned int y = 0; y < th; y++)
+    memmove(buf + y * tw * channels, buf + ((y0 + y) * width + x0) * channels,
+            tw * channels);
+  subtex->trim_left = (u16)x0;
+  subtex->trim_top = (u16)y0;
+  subtex->trim_right = (u16)(width - x1);
+  subtex->trim_bottom = (u16)(height - y1);
+  *w = (int)tw;
+  *h = (int)th;
+}
+
+/// Convert a decoded image to its texture format and swizzle it. `c` is
+/// the channel count of the source, `channels` the one of `buffer`.
+static bool StageDecodedImage(unsigned char *buffer, int w, int h, int c,
+                              int channels,
+                              const ProRender::ImageOptions &opts,
+                              ImageStage *stage) {
+  if (opts.trim_alpha)
+    TrimImage(buffer, &w, &h, channels, &stage->subtex);
+
+  GPU_TEXCOLOR format = opts.auto_format
+                            ? PickImageFormat(buffer, (unsigned int)(w * h), c,
+                                              (unsigned int)channels)
+                            : opts.format;
+  unsigned char probe[4] = {0, 0, 0, 0};
+  if (!ConvertPixels(probe, 1, 1, format, ProRender::DitherNone))
+    format = GPU_RGBA8;
+
+  bool ok = ConvertImage(stage, buffer, (unsigned int)channels,
+                         (unsigned int)w, (unsigned int)h, format, opts);
   stbi_image_free(buffer);
-  return img;
+  return ok;
 }
 
-static C2D_Image privLoadImageBuffer(std::vector<unsigned char> file_buffer) {
-  C2D_Image img;
-  int w, h, c;
-  unsigned char *buffer = (unsigned char *)stbi_load_from_memory(
-      file_buffer.data(), file_buffer.size(), &w, &h, &c, 4);
+/// Decode and convert an image file, going through the texture cache in
+/// `cache_dir` unless it is empty. Thread safe as long as `stage->tex` is
+/// not set or `stage->batch` is. Workers get a copy of the cache directory
+/// taken when the load was queued, not the global that SetImageCacheDir()
+/// may be changing meanwhile.
+static bool privStageImageFile(const std::string &path,
+                               const ProRender::ImageOptions &opts,
+                               const std::string &cache_dir,
+                               ImageStage *stage) {
+  u64 cache_key = 0;
+  bool use_cache = !cache_dir.empty() && GetTexCacheKey(path, opts, &cache_key);
+
+  if (use_cache && ReadTexCache(cache_dir, cache_key, stage))
+    return true;
+
+  int w, h, c, channels;
+  unsigned char *buffer = DecodeImageFile(path, opts, &w, &h, &c, &channels);
+  if (!CheckDecodedImage(buffer, w, h))
+    return false;
+
+  bool ok = StageDecodedImage(buffer, w, h, c, channels, opts, stage);
+  if (ok && use_cache)
+    WriteTexCache(cache_dir, cache_key, stage);
+  return ok;
+}
 
-  if (w > 1024 || h > 1024) {
-    stbi_image_free(buffer);
+/// Decode and convert an image in memory. An `owned` file buffer is freed
+/// right after decoding so it does not add to the peak memory use.
+static bool privStageImageBuffer(ProRender::BufferView file_buffer,
+                                 const ProRender::ImageOptions &opts,
+                                 ImageStage *stage,
+                                 std::vector<unsigned char> *owned = nullptr) {
+  int w, h, c, channels;
+  unsigned char *buffer =
+      DecodeImageMemory(file_buffer, opts, &w, &h, &c, &channels);
+  if (owned) {
+    owned->clear();
+    owned->shrink_to_fit();
+  }
+  if (!CheckDecodedImage(buffer, w, h))
+    return false;
+
+  return StageDecodedImage(buffer, w, h, c, channels, opts, stage);
+}
+
+static C2D_Image privLoadImageFile(const std::string &path,
+                                   const ProRender::ImageOptions &opts) {
+  ImageStage stage;
+  stage.tex = new C3D_Tex;
+  if (!privStageImageFile(path, opts, pr_image_cache_dir, &stage)) {
+    delete stage.tex;
     return C2D_Image();
   }
+  return UploadStage(&stage);
+}
 
-  C3D_Tex *tex = new C3D_Tex;
-  Tex3DS_SubTexture *subtex = new Tex3DS_SubTexture;
-  ConvertImage(tex, subtex, buffer, (unsigned int)(w * h * 4), (unsigned int)w,
-               (unsigned int)h, GPU_RGBA8);
-  img.tex = tex;
-  img.subtex = subtex;
-  stbi_image_free(buffer);
+static C2D_Image
+privLoadImageBuffer(ProRender::BufferView file_buffer,
+                    const ProRender::ImageOptions &opts,
+                    std::vector<unsigned char> *owned = nullptr) {
+  ImageStage stage;
+  stage.tex = new C3D_Tex;
+  if (!privStageImageBuffer(file_buffer, opts, &stage, owned)) {
+    delete stage.tex;
+    return C2D_Image();
+  }
+  return UploadStage(&stage);
+}
+
+/// TextureManager
+/// Owns every texture loaded through ProRender. Textures loaded from a file
+/// can be evicted when the memory budget is exceeded and are reloaded the
+/// next time they get drawn.
+struct TextureEntry {
+  ImageSubTexture *subtex = nullptr;
+  u64 key = 0; //< Image cache key, 0 if not shared
+  unsigned int refs = 1;
+  size_t bytes = 0;
+  u64 last_used = 0;
+  std::string path; //< Empty if the texture can not be reloaded
+  ProRender::ImageOptions opts;
+  bool resident = true;
+};
+
+struct TextureManager {
+  std::unordered_map<C3D_Tex *, TextureEntry> entries;
+  /// Shared images by path or content hash
+  std::unordered_map<u64, C3D_Tex *> images;
+  unsigned int hits = 0;
+  unsigned int misses = 0;
+  size_t budget = 0; //< 0 means unlimited
+  size_t used = 0;
+  u64 frame = 0;
+};
+
+static TextureManager pr_textures;
+
+/// Evict least recently drawn textures until the budget fits. Textures used
+/// in this or the last frame may still be read by the GPU and are kept.
+static void EnforceTextureBudget() {
+  TextureManager *mgr = &pr_textures;
+  while (mgr->budget && mgr->used > mgr->budget) {
+    C3D_Tex *lru = nullptr;
+    TextureEntry *lru_entry = nullptr;
+    for (auto &it : mgr->entries) {
+      TextureEntry &e = it.second;
+      if (!e.resident || e.path.empty() || e.last_used + 1 >= mgr->frame)
+        continue;
+      if (!lru_entry || e.last_used < lru_entry->last_used) {
+        lru = it.first;
+        lru_entry = &e;
+      }
+    }
+    if (!lru)
+      return;
+    // C3D_TexDelete() leaves the pointer behind, clear it so nothing hands
+    // the freed memory to the GPU when a reload fails
+    C3D_TexDelete(lru);
+    lru->data = nullptr;
+    lru_entry->resident = false;
+    mgr->used -= lru_entry->bytes;
+  }
+}
+
+static void FreeTexture(C3D_Tex *tex, TextureEntry &e);
+
+/// Image cache key of a file path, independent of how the path is spelled
+static u64 GetImageKey(const std::string &path,
+                       const ProRender::ImageOptions &opts) {
+  std::string norm = std::filesystem::path(path).lexically_normal().string();
+  u64 hash = HashBytes("file", 4);
+  return HashImageOptions(opts, HashBytes(norm.data(), norm.size(), hash));
+}
+
+/// Image cache key of an encoded image in memory
+static u64 GetImageKey(const unsigned char *data, size_t size,
+                       const ProRender::ImageOptions &opts) {
+  u64 hash = HashBytes("data", 4);
+  return HashImageOptions(opts, HashBytes(data, size, hash));
+}
+
+/// Take another reference on an already loaded image
+static bool FindSharedImage(u64 key, C2D_Image *img) {
+  auto it = pr_textures.images.find(key);
+  if (it == pr_textures.images.end())
+    return false;
+  TextureEntry &e = pr_textures.entries[it->second];
+  e.refs++;
+  pr_textures.hits++;
+  img->tex = it->second;
+  img->subtex = e.subtex;
+  return true;
+}
+
+/// Hand a freshly loaded image to the manager. With a key it is shared by
+/// later loads of the same source, if the key got loaded meanwhile (async
+/// loads racing each other) the new copy is dropped for the existing one.
+static C2D_Image RegisterTexture(C2D_Image img, const std::string &path,
+                                 const ProRender::ImageOptions &opts,
+                                 u64 key = 0) {
+  if (!img.tex)
+    return img;
+  TextureEntry entry;
+  entry.subtex = (ImageSubTexture *)img.subtex;
+  entry.key = key;
+  entry.bytes = C3D_TexCalcTotalSize(img.tex->size, img.tex->maxLevel);
+  entry.last_used = pr_textures.frame;
+  entry.path = path;
+  entry.opts = opts;
+  if (key) {
+    C2D_Image shared;
+    if (FindSharedImage(key, &shared)) {
+      pr_textures.hits--;
+      FreeTexture(img.tex, entry);
+      return shared;
+    }
+    pr_textures.misses++;
+    pr_textures.images[key] = img.tex;
+  }
+  pr_textures.used += entry.bytes;
+  pr_textures.entries[img.tex] = entry;
+  EnforceTextureBudget();
   return img;
 }
 
+/// Mark a texture as drawn this frame, reloads it if it got evicted
+static TextureEntry *TouchTexture(C3D_Tex *tex) {
+  auto it = pr_textures.entries.find(tex);
+  if (it == pr_textures.entries.end())
+    return nullptr;
+  TextureEntry &e = it->second;
+  e.last_used = pr_textures.frame;
+  if (e.resident)
+    return &e;
+
+  ImageStage stage;
+  stage.tex = tex;
+  if (!privStageImageFile(e.path, e.opts, pr_image_cache_dir, &stage))
+    return &e;
+  FinalizeTexture(tex);
+  e.resident = true;
+  e.bytes = C3D_TexCalcTotalSize(tex->size, tex->maxLevel);
+  pr_textures.used += e.bytes;
+  EnforceTextureBudget();
+  return &e;
+}
+
+static void FreeTexture(C3D_Tex *tex, TextureEntry &e) {
+  if (e.resident)
+    C3D_TexDelete(tex);
+  delete e.subtex;
+  delete tex;
+}
+
+/// WorkerThread
+/// The worker runs one priority step below the thread that starts it, so
+/// it only gets the time the render thread spends waiting for the GPU or
+/// VBlank instead of stalling it.
+class WorkerThread {
+public:
+  bool Start(void (*func)(void *), void *arg, int core = -2) {
+    s32 prio = 0x30;
+    svcGetThreadPriority(&prio, CUR_THREAD_HANDLE);
+    thread = threadCreate(func, arg, 64 * 1024, std::min(prio + 1, 0x3F),
+                          core, false);
+    return thread != nullptr;
+  }
+
+  void Join() {
+    if (thread) {
+      threadJoin(thread, U64_MAX);
+      threadFree(thread);
+      thread = nullptr;
+    }
+  }
+
+private:
+  Thread thread = nullptr;
+};
+
+/// Number of threads batch loads are spread across, 2 cores on Old 3DS and
+/// 4 on New 3DS
+static unsigned int GetWorkerCount() {
+  bool is_new3ds = false;
+  APT_CheckNew3DS(&is_new3ds);
+  return is_new3ds ? 4 : 2;
+}
+
+/// BatchLoad
+/// LoadImageFiles() decodes and converts straight into the textures, so a
+/// batch holds no staging copies, only the decoded image each thread is
+/// working on. Allocating and freeing textures is left to the calling
+/// thread: helpers queue a request and wait for it to be served.
+struct BatchTextureRequest {
+  ImageStage *stage;
+  bool release; //< Free the texture instead of allocating it
+  bool ok = false;
+  bool done = false;
+};
+
+struct BatchLoad {
+  const std::vector<std::string> *paths;
+  const std::vector<unsigned int> *todo; //< Indices into `paths` to load
+  const ProRender::ImageOptions *opts;
+  std::string cache_dir;
+  std::vector<ImageStage> stages;
+  std::vector<char> ok;
+  std::atomic<unsigned int> next;
+  std::mutex mutex;
+  std::condition_variable cv;
+  std::deque<BatchTextureRequest *> requests;
+  std::vector<unsigned int> finished; //< Entries staged by helpers
+};
+
+static bool RequestBatchTexture(BatchLoad *batch, ImageStage *stage,
+                                bool release) {
+  BatchTextureRequest req;
+  req.stage = stage;
+  req.release = release;
+  std::unique_lock<std::mutex> lock(batch->mutex);
+  batch->requests.push_back(&req);
+  batch->cv.notify_all();
+  batch->cv.wait(lock, [&] { return req.done; });
+  return req.ok;
+}
+
+/// Serve the texture requests of the helpers, called with `mutex` held
+static void ServeBatchRequests(BatchLoad *batch) {
+  if (batch->requests.empty())
+    return;
+  for (BatchTextureRequest *req : batch->requests) {
+    if (req->release)
+      req->stage->DeleteTexture();
+    else
+      req->ok = req->stage->InitTexture();
+    req->done = true;
+  }
+  batch->requests.clear();
+  batch->cv.notify_all();
+}
+
+static void StageBatchEntry(BatchLoad *batch, unsigned int i, bool helper) {
+  ImageStage *stage = &batch->stages[i];
+  stage->tex = new C3D_Tex;
+  stage->batch = helper ? batch : nullptr;
+  batch->ok[i] = privStageImageFile((*batch->paths)[(*batch->todo)[i]],
+                                    *batch->opts, batch->cache_dir, stage);
+  stage->batch = nullptr;
+  if (!batch->ok[i]) {
+    delete stage->tex;
+    stage->tex = nullptr;
+  }
+}
+
+static void BatchLoadMain(void *arg) {
+  BatchLoad *batch = (BatchLoad *)arg;
+  unsigned int count = (unsigned int)batch->todo->size();
+  for (unsigned int i = batch->next++; i < count; i = batch->next++) {
+    StageBatchEntry(batch, i, true);
+    std::lock_guard<std::mutex> lock(batch->mutex);
+    batch->finished.push_back(i);
+    batch->cv.notify_all();
+  }
+}
+
+/// Load every entry of a batch spread across the available cores, calling
+/// `upload(i)` on this thread once entry `i` is staged. This thread takes
+/// part, helpers go to cores 1..n. Cores the app may not use (e.g. the
+/// syscore without APT_SetAppCpuTimeLimit) just fail to start a thread and
+/// are skipped.
+template <typename Upload>
+static void RunBatchLoad(BatchLoad *batch, Upload upload) {
+  unsigned int count = (unsigned int)batch->todo->size();
+  batch->stages = std::vector<ImageStage>(count);
+  batch->ok.assign(count, 0);
+  batch->next = 0;
+
+  unsigned int helpers = std::min(GetWorkerCount(), count) - 1;
+  std::vector<WorkerThread> threads(helpers);
+  for (unsigned int i = 0; i < helpers; i++)
+    threads[i].Start(BatchLoadMain, batch, (int)i + 1);
+
+  std::vector<unsigned int> ready;
+  for (unsigned int uploaded = 0; uploaded < count;) {
+    {
+      std::unique_lock<std::mutex> lock(batch->mutex);
+      // Only wait when there is nothing left to load here
+      if (batch->next >= count)
+        batch->cv.wait(lock, [&] {
+          return !batch->requests.empty() || !batch->finished.empty();
+        });
+      ServeBatchRequests(batch);
+      ready.swap(batch->finished);
+    }
+    for (unsigned int i : ready)
+      upload(i);
+    uploaded += (unsigned int)ready.size();
+    ready.clear();
+
+    unsigned int i = batch->next++;
+    if (i < count) {
+      StageBatchEntry(batch, i, false);
+      upload(i);
+      uploaded++;
+    }
+  }
+  for (auto &thread : threads)
+    thread.Join();
+}
+
+/// AsyncLoader
+/// Decoding and swizzling run on a worker thread into an ImageStage,
+/// PollLoads() does the texture allocation and flush on the render thread.
+struct AsyncLoadJob {
+  std::string path;
+  ProRender::ImageOptions opts;
+  std::string cache_dir;
+  ProRender::ImageLoadHandle handle;
+  ImageStage stage;
+  bool ok = false;
+};
+
+struct AsyncLoader {
+  WorkerThread worker;
+  std::mutex mutex;
+  std::condition_variable cv;
+  std::deque<std::unique_ptr<AsyncLoadJob>> pending;
+  std::vector<std::unique_ptr<AsyncLoadJob>> finished;
+  bool running = false;
+  bool stop = false;
+};
+
+static AsyncLoader pr_async_loader;
+
+static void AsyncLoaderMain(void *arg) {
+  AsyncLoader *loader = (AsyncLoader *)arg;
+  while (true) {
+    std::unique_ptr<AsyncLoadJob> job;
+    {
+      std::unique_lock<std::mutex> lock(loader->mutex);
+      loader->cv.wait(lock,
+                      [&] { return loader->stop || !loader->pending.empty(); });
+      if (loader->stop)
+        return;
+      job = std::move(loader->pending.front());
+      loader->pending.pop_front();
+    }
+
+    job->ok = privStageImageFile(job->path, job->opts, job->cache_dir,
+                                 &job->stage);
+
+    std::lock_guard<std::mutex> lock(loader->mutex);
+    loader->finished.push_back(std::move(job));
+  }
+}
+
+static void StopAsyncLoader() {
+  AsyncLoader *loader = &pr_async_loader;
+  if (!loader->running)
+    return;
+  {
+    std::lock_guard<std::mutex> lock(loader->mutex);
+    loader->stop = true;
+  }
+  loader->cv.notify_all();
+  loader->worker.Join();
+  loader->pending.clear();
+  loader->finished.clear();
+  loader->running = false;
+  loader->stop = false;
+}
+
 struct RenderContext {
   ~RenderContext() {
     C2D_TextBufDelete(TextBuffer);
@@ -165,11 +1328,219 @@ struct RenderContext {
   C2D_TextBuf TextBuffer;
   C2D_Font DefaultFont;
 
-  bool IsTopNow = false;
+  /// Size of the target drawn to, used for alignment and culling
+  float TargetWidth = 400.0f;
+  float TargetHeight = 240.0f;
 };
 
 RenderContext *pr_context = NULL;
 
+/// TextCache
+struct TextCacheEntry {
+  std::string str;
+  C2D_Font font;
+  C2D_Text text;
+  u64 last_used;
+};
+
+/// Parsed texts in a text buffer that outlives frames. A text buffer can
+/// only be cleared as a whole, so when it is full the texts still in use
+/// get parsed into it again and the rest is dropped.
+struct TextCache {
+  std::unordered_map<u64, TextCacheEntry> entries;
+  C2D_TextBuf buf = nullptr;
+  size_t capacity = 8192; //< Glyphs
+  unsigned int hits = 0;
+  unsigned int misses = 0;
+  u64 frame = 0;
+};
+
+static TextCache pr_text_cache;
+
+/// Parse into the cache buffer, false if it ran full
+static bool ParseCachedText(TextCacheEntry &e) {
+  const char *end =
+      C2D_TextFontParse(&e.text, e.font, pr_text_cache.buf, e.str.c_str());
+  if (!end || *end)
+    return false;
+  C2D_TextOptimize(&e.text);
+  return true;
+}
+
+/// Rebuild the cache buffer from the most recently used texts, filling at
+/// most half of it so the next compaction is a while away. Texts used this
+/// frame are always kept as callers may still hold them, they fit because
+/// they were in the buffer before.
+static void CompactTextCache() {
+  TextCache *cache = &pr_text_cache;
+  std::vector<std::pair<u64, u64>> order; // last_used, key
+  order.reserve(cache->entries.size());
+  for (auto &it : cache->entries)
+    order.emplace_back(it.second.last_used, it.first);
+  std::sort(order.rbegin(), order.rend());
+
+  C2D_TextBufClear(cache->buf);
+  size_t used = 0;
+  for (auto &it : order) {
+    auto e = cache->entries.find(it.second);
+    size_t glyphs = e->second.text.end - e->second.text.begin;
+    bool keep =
+        it.first == cache->frame || used + glyphs <= cache->capacity / 2;
+    if (keep && ParseCachedText(e->second))
+      used += glyphs;
+    else
+      cache->entries.erase(e);
+  }
+}
+
+/// Parsed and optimized `str`, from the cache when possible. Otherwise it
+/// is parsed into the per frame buffer through `scratch`. Valid until the
+/// next NewFrame.
+static const C2D_Text *GetText(std::string_view str, C2D_Font fnt,
+                               C2D_Text *scratch) {
+  if (!fnt)
+    fnt = pr_context->DefaultFont;
+  TextCache *cache = &pr_text_cache;
+  if (cache->buf) {
+    u64 key = HashBytes(str.data(), str.size(), HashBytes(&fnt, sizeof(fnt)));
+    auto it = cache->entries.find(key);
+    if (it != cache->entries.end() && it->second.font == fnt &&
+        it->second.str == str) {
+      it->second.last_used = cache->frame;
+      cache->hits++;
+      return &it->second.text;
+    }
+    cache->misses++;
+    // Texts that may need half the buffer are not worth compacting it for.
+    // A colliding text drawn this frame stays, this one goes uncached.
+    bool fits = str.size() <= cache->capacity / 2;
+    if (fits && (it == cache->entries.end() ||
+                 it->second.last_used != cache->frame)) {
+      if (it != cache->entries.end())
+        cache->entries.erase(it);
+      TextCacheEntry e = {std::string(str), fnt, {}, cache->frame};
+      bool ok = ParseCachedText(e);
+      if (!ok) {
+        CompactTextCache();
+        ok = ParseCachedText(e);
+      }
+      if (ok)
+        return &(cache->entries[key] = std::move(e)).text;
+    }
+  }
+
+  // The parser needs a terminated string, views of lines are not
+  static std::string terminated;
+  terminated.assign(str.data(), str.size());
+  C2D_TextFontParse(scratch, fnt, pr_context->TextBuffer, terminated.c_str());
+  C2D_TextOptimize(scratch);
+  return scratch;
+}
+
+/// TextMetrics
+/// Unscaled size of a text. Widths scale linearly, the height is whole
+/// lines of the font's line feed, so one entry serves every size.
+struct TextMetrics {
+  std::string str;
+  C2D_Font font;
+  float width;
+  u32 lines;
+};
+
+/// Measured texts, dropped as a whole once it holds this many
+static const size_t TEXT_METRICS_MAX = 1024;
+static std::unordered_map<u64, TextMetrics> pr_text_metrics;
+
+/// Measure `str` the way C2D_TextFontParse lays it out, from the advance
+/// widths of the font without putting glyphs into any text buffer
+static const TextMetrics *MeasureText(std::string_view str, C2D_Font fnt) {
+  u64 key = HashBytes(str.data(), str.size(), HashBytes(&fnt, sizeof(fnt)));
+  auto it = pr_text_metrics.find(key);
+  if (it != pr_text_metrics.end() && it->second.font == fnt &&
+      it->second.str == str)
+    return &it->second;
+
+  float width = 0, line_width = 0;
+  u32 lines = 1;
+  const uint8_t *p = (const uint8_t *)str.data(), *end = p + str.size();
+  while (p < end && *p) {
+    // Do not let a sequence cut off by the end of the view read past it
+    ptrdiff_t len = *p < 0xC0 ? 1 : *p < 0xE0 ? 2 : *p < 0xF0 ? 3 : 4;
+    uint32_t code;
+    ssize_t units = len <= end - p ? decode_utf8(&code, p) : -1;
+    if (units < 1) {
+      code = 0xFFFD;
+      units = 1;
+    }
+    p += units;
+    if (code == '\n') {
+      width = std::max(width, line_width);
+      line_width = 0;
+      lines++;
+      continue;
+    }
+    fontGlyphPos_s pos;
+    C2D_FontCalcGlyphPos(fnt, &pos, C2D_FontGlyphIndexFromCodePoint(fnt, code),
+                         0, 1.0f, 1.0f);
+    line_width += pos.xAdvance;
+  }
+  width = std::max(width, line_width);
+
+  if (pr_text_metrics.size() >= TEXT_METRICS_MAX)
+    pr_text_metrics.clear();
+  TextMetrics &m = pr_text_metrics[key];
+  m = {std::string(str), fnt, width, lines};
+  return &m;
+}
+
+static void ResetTextCache() {
+  TextCache *cache = &pr_text_cache;
+  cache->entries.clear();
+  if (cache->buf)
+    C2D_TextBufDelete(cache->buf);
+  cache->buf = nullptr;
+  if (pr_context && cache->capacity)
+    cache->buf = C2D_TextBufNew(cache->capacity);
+}
+
+/// Walks the lines of a text as views into it, nothing gets copied
+struct LineIterator {
+  std::string_view rest;
+  bool done = false;
+
+  bool Next(std::string_view *line) {
+    if (done)
+      return false;
+    size_t nl = rest.find('\n');
+    *line = rest.substr(0, nl);
+    if (nl == rest.npos)
+      done = true;
+    else
+      rest.remove_prefix(nl + 1);
+    return true;
+  }
+};
+
+/// Draw every line on its own, aligned at `anchor` + x. `align` is how much
+/// of a line lies left of the anchor, 0.5 centers and 1 aligns right.
+static void DrawTextLines(std::string_view text, float size, float x, float y,
+                          unsigned int color, float maxW, float maxH,
+                          C2D_Font fnt, float anchor, float align) {
+  if (!fnt)
+    fnt = pr_context->DefaultFont;
+  float lineHeight = ceilf(size * C2D_FontGetInfo(fnt)->lineFeed);
+
+  LineIterator lines = {text};
+  std::string_view line;
+  for (int n = 0; lines.Next(&line); n++) {
+    float width = size * MeasureText(line, fnt)->width;
+    if (maxW != 0)
+      width = std::min(maxW, width);
+    ProRender::DrawText(line, size, anchor + x - width * align,
+                        y + lineHeight * n, color, maxW, maxH, fnt);
+  }
+}
+
 namespace ProRender {
 void Init() {
   pr_context = new RenderContext;
@@ -180,9 +1551,21 @@ void Init() {
   pr_context->targets[2] = C2D_CreateScreenTarget(GFX_TOP, GFX_RIGHT);
   pr_context->TextBuffer = C2D_TextBufNew(4096);
   pr_context->DefaultFont = C2D_FontLoadSystem(CFG_REGION_USA);
+  ResetTextCache();
 }
 
-void Exit() { delete pr_context; }
+void Exit() {
+  StopAsyncLoader();
+  for (auto &it : pr_textures.entries)
+    FreeTexture(it.first, it.second);
+  pr_textures.entries.clear();
+  pr_textures.images.clear();
+  pr_textures.used = 0;
+  delete pr_context;
+  pr_context = NULL;
+  ResetTextCache();
+  pr_text_metrics.clear();
+}
 
 void ClearTextBuffer() { C2D_TextBufClear(pr_context->TextBuffer); }
 
@@ -191,6 +1574,11 @@ void NewFrame() {
   C2D_TargetClear(pr_context->targets[1], 0x00000000);
   C2D_TargetClear(pr_context->targets[2], 0x00000000);
   ClearTextBuffer();
+  pr_text_cache.frame++;
+  pr_text_cache.hits = 0;
+  pr_text_cache.misses = 0;
+  pr_textures.frame++;
+  EnforceTextureBudget();
 }
 
 void StartDrawOn(RenderTarget target) {
@@ -199,7 +1587,19 @@ void StartDrawOn(RenderTarget target) {
 
   C2D_Prepare();
   C2D_SceneBegin(pr_context->targets[(int)target]);
-  pr_context->IsTopNow = ((target == Top || target == TopRight) ? true : false);
+  pr_context->TargetWidth = (target == Bottom) ? 320.0f : 400.0f;
+  pr_context->TargetHeight = 240.0f;
+}
+
+void StartDrawOn(RenderTexture &target) {
+  if (!target.target)
+    return;
+  C3D_FrameBegin(2);
+
+  C2D_Prepare();
+  C2D_SceneBegin(target.target);
+  pr_context->TargetWidth = (float)target.GetWidth();
+  pr_context->TargetHeight = (float)target.GetHeight();
 }
 
 unsigned int FastColor32(unsigned char r, unsigned char g, unsigned char b,
@@ -217,7 +1617,7 @@ unsigned int FastColorF(float r, float g, float b, float a) {
           (((la)&0xFF) << 24));
 }
 
-unsigned int FastColorHex(std::string hex_str, unsigned char a) {
+unsigned int FastColorHex(std::string_view hex_str, unsigned char a) {
   if (hex_str.length() < 7 ||
       std::find_if(hex_str.begin() + 1, hex_str.end(),
                    [](char c) { return !std::isxdigit(c); }) != hex_str.end()) {
@@ -235,30 +1635,877 @@ unsigned int FastColorHex(std::string hex_str, unsigned char a) {
           (((a)&0xFF) << 24));
 }
 
-C2D_Font LoadFont(std::string path) { return C2D_FontLoad(path.c_str()); }
+C2D_Font LoadFont(std::string_view path) {
+  return C2D_FontLoad(std::string(path).c_str());
+}
+
+void DeleteFont(C2D_Font font) {
+  // Cached texts point at the glyph sheets of the font
+  auto &entries = pr_text_cache.entries;
+  for (auto it = entries.begin(); it != entries.end();) {
+    if (it->second.font == font)
+      it = entries.erase(it);
+    else
+      ++it;
+  }
+  // A new font may get the same address
+  for (auto it = pr_text_metrics.begin(); it != pr_text_metrics.end();) {
+    if (it->second.font == font)
+      it = pr_text_metrics.erase(it);
+    else
+      ++it;
+  }
+  C2D_FontFree(font);
+}
+
+C2D_Image LoadImageFile(std::string_view path, const ImageOptions &opts) {
+  C2D_Image img;
+  std::string file(path);
+  u64 key = GetImageKey(file, opts);
+  if (FindSharedImage(key, &img))
+    return img;
+  return RegisterTexture(privLoadImageFile(file, opts), file, opts, key);
+}
+
+C2D_Image LoadImageBuffer(BufferView buffer, const ImageOptions &opts) {
+  C2D_Image img;
+  u64 key = GetImageKey(buffer.data, buffer.size, opts);
+  if (FindSharedImage(key, &img))
+    return img;
+  return RegisterTexture(privLoadImageBuffer(buffer, opts), "", opts, key);
+}
+
+C2D_Image LoadImageBuffer(const unsigned char *data, size_t size,
+                          const ImageOptions &opts) {
+  return LoadImageBuffer(BufferView(data, size), opts);
+}
+
+C2D_Image LoadImageBuffer(std::vector<unsigned char> &&buffer,
+                          const ImageOptions &opts) {
+  C2D_Image img;
+  std::vector<unsigned char> owned(std::move(buffer));
+  u64 key = GetImageKey(owned.data(), owned.size(), opts);
+  if (FindSharedImage(key, &img))
+    return img;
+  return RegisterTexture(privLoadImageBuffer(owned, opts, &owned), "", opts,
+                         key);
+}
+
+ImageLoadHandle LoadImageFileAsync(std::string_view path,
+                                   const ImageOptions &opts) {
+  AsyncLoader *loader = &pr_async_loader;
+  auto job = std::make_unique<AsyncLoadJob>();
+  job->path = path;
+  job->opts = opts;
+  job->cache_dir = pr_image_cache_dir;
+  job->handle = std::make_shared<ImageLoad>();
+  ImageLoadHandle handle = job->handle;
+  u64 key = GetImageKey(job->path, opts);
+  if (FindSharedImage(key, &handle->image)) {
+    handle->done = true;
+    return handle;
+  }
+  if (!loader->running)
+    loader->running = loader->worker.Start(AsyncLoaderMain, loader);
+  if (!loader->running) {
+    // Without a worker nothing would ever finish the job, load it here
+    handle->image = RegisterTexture(privLoadImageFile(job->path, opts),
+                                    job->path, opts, key);
+    handle->done = true;
+    return handle;
+  }
+  {
+    std::lock_guard<std::mutex> lock(loader->mutex);
+    loader->pending.push_back(std::move(job));
+  }
+  loader->cv.notify_one();
+  return handle;
+}
+
+void PollLoads() {
+  AsyncLoader *loader = &pr_async_loader;
+  std::vector<std::unique_ptr<AsyncLoadJob>> done;
+  {
+    std::lock_guard<std::mutex> lock(loader->mutex);
+    done.swap(loader->finished);
+  }
+  for (auto &job : done) {
+    if (job->ok)
+      job->handle->image =
+          RegisterTexture(UploadStage(&job->stage), job->path, job->opts,
+                          GetImageKey(job->path, job->opts));
+    job->handle->done = true;
+  }
+}
+
+std::vector<C2D_Image> LoadImageFiles(const std::vector<std::string> &paths,
+                                      const ImageOptions &opts) {
+  std::vector<C2D_Image> images(paths.size(), C2D_Image());
+  std::vector<u64> keys(paths.size());
+  std::vector<unsigned int> todo;
+  std::unordered_map<u64, size_t> batch;
+  for (size_t i = 0; i < paths.size(); i++) {
+    keys[i] = GetImageKey(paths[i], opts);
+    // Already loaded or loaded by an earlier entry of this batch
+    if (pr_textures.images.count(keys[i]) || !batch.emplace(keys[i], i).second)
+      continue;
+    todo.push_back((unsigned int)i);
+  }
+
+  if (!todo.empty()) {
+    BatchLoad batch;
+    batch.paths = &paths;
+    batch.todo = &todo;
+    batch.opts = &opts;
+    batch.cache_dir = pr_image_cache_dir;
+    // Flushing and registering stay on this thread, results keep the order
+    // of `paths`
+    RunBatchLoad(&batch, [&](unsigned int i) {
+      unsigned int n = todo[i];
+      if (batch.ok[i])
+        images[n] = RegisterTexture(UploadStage(&batch.stages[i]), paths[n],
+                                    opts, keys[n]);
+    });
+  }
+  for (size_t i = 0; i < paths.size(); i++) {
+    if (!images[i].tex)
+      FindSharedImage(keys[i], &images[i]);
+  }
+  return images;
+}
+
+void DeleteImage(C2D_Image img) {
+  auto it = pr_textures.entries.find(img.tex);
+  if (it == pr_textures.entries.end() || --it->second.refs > 0)
+    return;
+  if (it->second.resident)
+    pr_textures.used -= it->second.bytes;
+  if (it->second.key)
+    pr_textures.images.erase(it->second.key);
+  FreeTexture(it->first, it->second);
+  pr_textures.entries.erase(it);
+}
+
+bool UpdateImageRect(C2D_Image img, const unsigned char *rgba, unsigned int x,
+                     unsigned int y, unsigned int width, unsigned int height,
+                     unsigned int pitch) {
+  C3D_Tex *tex = img.tex;
+  const Tex3DS_SubTexture *sub = img.subtex;
+  if (!tex || !sub || !rgba || tex->fmt == GPU_ETC1 || tex->fmt == GPU_ETC1A4)
+    return false;
+
+  TextureEntry *e = TouchTexture(tex);
+  if (e) {
+    if (!e->resident)
+      return false;
+    // The pixels no longer match the file, keep later loads and the budget
+    // from handing out or reloading the original
+    if (e->key)
+      pr_textures.images.erase(e->key);
+    e->key = 0;
+    e->path.clear();
+  }
+
+  // The source stride follows the caller's width, not the clipped one
+  if (!pitch)
+    pitch = width * 4;
+
+  // A loaded image is addressed like the full file, as DrawImage() does.
+  // Margins cut off by trim_alpha are not in the texture, drop the source
+  // pixels that land in them.
+  if (e && sub == e->subtex) {
+    unsigned int left = e->subtex->trim_left, top = e->subtex->trim_top;
+    if (x + width <= left || y + height <= top)
+      return true;
+    if (x < left) {
+      rgba += (left - x) * 4;
+      width -= left - x;
+      x = left;
+    }
+    if (y < top) {
+      rgba += (top - y) * pitch;
+      height -= top - y;
+      y = top;
+    }
+    x -= left;
+    y -= top;
+  }
+  if (x >= sub->width || y >= sub->height)
+    return true;
+  width = std::min(width, sub->width - x);
+  height = std::min(height, sub->height - y);
+
+  // Render thread only, so one scratch buffer serves every update
+  static std::vector<unsigned char> scratch;
+  scratch.resize(width * height * 4);
+  for (unsigned int row = 0; row < height; row++)
+    memcpy(&scratch[row * width * 4], rgba + row * pitch, width * 4);
+  unsigned int pixel_size =
+      ConvertPixels(scratch.data(), width, height, tex->fmt, DitherNone);
+  if (!pixel_size)
+    return false;
+
+  unsigned int tx = (unsigned int)lroundf(sub->left * tex->width) + x;
+  unsigned int ty = (unsigned int)lroundf((1.0f - sub->top) * tex->height) + y;
+  SwizzleRect(pixel_size, (unsigned char *)tex->data, scratch.data(),
+              width * pixel_size, width, height, tex->width, tx, ty);
+  FlushTextureRect(tex, tx, ty, tx + width, ty + height);
+  return true;
+}
+
+ImageCacheStats GetImageCacheStats() {
+  ImageCacheStats stats;
+  stats.hits = pr_textures.hits;
+  stats.misses = pr_textures.misses;
+  return stats;
+}
+
+void SetTextureBudget(size_t bytes) {
+  pr_textures.budget = bytes;
+  EnforceTextureBudget();
+}
+
+size_t GetTextureMemoryUsed() { return pr_textures.used; }
+
+struct TextureAtlas::Page {
+  C3D_Tex tex;
+  /// Skyline segments, x sorted. Each one is the lowest free row from x to
+  /// x + w.
+  struct Node {
+    unsigned int x, y, w;
+  };
+  std::vector<Node> skyline;
+};
+
+TextureAtlas::TextureAtlas(unsigned int size, GPU_TEXCOLOR format)
+    : size(std::min(GetPower2(size), 1024u)), format(format) {
+  unsigned char probe[4] = {0, 0, 0, 0};
+  pixel_size = ConvertPixels(probe, 1, 1, format, DitherNone);
+  if (!pixel_size || format == GPU_ETC1 || format == GPU_ETC1A4) {
+    // Compressed blocks can not be packed at pixel granularity
+    this->format = GPU_RGBA8;
+    pixel_size = 4;
+  }
+}
+
+TextureAtlas::~TextureAtlas() {
+  for (auto page : pages) {
+    C3D_TexDelete(&page->tex);
+    delete page;
+  }
+}
+
+/// Bottom-left skyline fit, returns the node index or -1
+static int AtlasFindPosition(const TextureAtlas::Page *page,
+                             unsigned int size, unsigned int w, unsigned int h,
+                             unsigned int *out_x, unsigned int *out_y) {
+  int best = -1;
+  unsigned int best_x = 0, best_y = size;
+  for (size_t i = 0; i < page->skyline.size(); i++) {
+    unsigned int x = page->skyline[i].x;
+    if (x + w > size)
+      break;
+    unsigned int y = 0;
+    for (size_t j = i; j < page->skyline.size() && page->skyline[j].x < x + w;
+         j++)
+      y = std::max(y, page->skyline[j].y);
+    if (y + h <= size && y < best_y) {
+      best = (int)i;
+      best_x = x;
+      best_y = y;
+    }
+  }
+  *out_x = best_x;
+  *out_y = best_y;
+  return best;
+}
+
+static void AtlasInsert(TextureAtlas::Page *page, int index, unsigned int x,
+                        unsigned int y, unsigned int w, unsigned int h) {
+  auto &sky = page->skyline;
+  sky.insert(sky.begin() + index, {x, y + h, w});
+  // Cut away what the new segment covers
+  for (size_t i = index + 1; i < sky.size();) {
+    unsigned int end = x + w;
+    if (sky[i].x >= end)
+      break;
+    unsigned int shrink = end - sky[i].x;
+    if (shrink >= sky[i].w) {
+      sky.erase(sky.begin() + i);
+      continue;
+    }
+    sky[i].x += shrink;
+    sky[i].w -= shrink;
+    break;
+  }
+  // Merge neighbours of the same height
+  for (size_t i = 0; i + 1 < sky.size();) {
+    if (sky[i].y == sky[i + 1].y) {
+      sky[i].w += sky[i + 1].w;
+      sky.erase(sky.begin() + i + 1);
+    } else {
+      i++;
+    }
+  }
+}
+
+C2D_Image TextureAtlas::AddImageRGBA(unsigned char *rgba, unsigned int width,
+                                     unsigned int height) {
+  // Keep one free pixel to the right and below every image
+  unsigned int w = width + 1, h = height + 1;
+  if (!rgba || !width || !height || width > size || height > size)
+    return C2D_Image();
+
+  Page *page = nullptr;
+  unsigned int x = 0, y = 0;
+  int index = -1;
+  for (auto p : pages) {
+    index = AtlasFindPosition(p, size, std::min(w, size), std::min(h, size),
+                              &x, &y);
+    if (index >= 0) {
+      page = p;
+      break;
+    }
+  }
+  if (!page) {
+    page = new Page;
+    if (!C3D_TexInit(&page->tex, (u16)size, (u16)size, format)) {
+      delete page;
+      return C2D_Image();
+    }
+    memset(page->tex.data, 0, page->tex.size);
+    FinalizeTexture(&page->tex);
+    page->skyline.push_back({0, 0, size});
+    pages.push_back(page);
+    index = AtlasFindPosition(page, size, std::min(w, size), std::min(h, size),
+                              &x, &y);
+  }
+  AtlasInsert(page, index, x, y, std::min(w, size), std::min(h, size));
+
+  ConvertPixels(rgba, width, height, format, DitherNone);
+  SwizzleRect(pixel_size, (unsigned char *)page->tex.data, rgba,
+              width * pixel_size, width, height, size, x, y);
+  FlushTextureRows(&page->tex, y, y + height);
+
+  subtextures.push_back(Tex3DS_SubTexture());
+  Tex3DS_SubTexture *subtex = &subtextures.back();
+  subtex->width = (u16)width;
+  subtex->height = (u16)height;
+  subtex->left = x / (float)size;
+  subtex->top = 1.0f - (y / (float)size);
+  subtex->right = (x + width) / (float)size;
+  subtex->bottom = 1.0f - ((y + height) / (float)size);
+
+  C2D_Image img;
+  img.tex = &page->tex;
+  img.subtex = subtex;
+  return img;
+}
+
+/// Pack a decoded RGBA8 image and free it, the shared part of
+/// TextureAtlas::AddImageFile() and AddImageBuffer()
+static C2D_Image AddDecodedAtlasImage(TextureAtlas *atlas, unsigned char *rgba,
+                                      int w, int h) {
+  if (!CheckDecodedImage(rgba, w, h))
+    return C2D_Image();
+  C2D_Image img = atlas->AddImageRGBA(rgba, (unsigned int)w, (unsigned int)h);
+  stbi_image_free(rgba);
+  return img;
+}
+
+C2D_Image TextureAtlas::AddImageFile(std::string_view path) {
+  int w, h, c, channels;
+  unsigned char *rgba = DecodeImageFile(std::string(path), ImageOptions(), &w,
+                                        &h, &c, &channels, DecodeForRGBA);
+  return AddDecodedAtlasImage(this, rgba, w, h);
+}
+
+C2D_Image TextureAtlas::AddImageBuffer(BufferView buffer) {
+  int w, h, c, channels;
+  unsigned char *rgba = DecodeImageMemory(buffer, ImageOptions(), &w, &h, &c,
+                                          &channels, DecodeForRGBA);
+  return AddDecodedAtlasImage(this, rgba, w, h);
+}
+
+/// LargeImage
+/// Edge length of the tiles a LargeImage gets split into
+static const unsigned int LARGE_IMAGE_TILE = 1024;
+
+struct LargeImage::Tile {
+  C3D_Tex tex;
+  Tex3DS_SubTexture subtex;
+  unsigned int x, y;
+};
+
+void LargeImage::Free() {
+  for (auto tile : tiles) {
+    C3D_TexDelete(&tile->tex);
+    delete tile;
+  }
+  tiles.clear();
+  width = height = 0;
+}
+
+bool LargeImage::LoadRGBA(unsigned char *rgba, unsigned int w, unsigned int h,
+                          const ImageOptions &opts) {
+  Free();
+  if (!rgba || !w || !h)
+    return false;
+
+  GPU_TEXCOLOR format = opts.auto_format ? PickImageFormat(rgba, w * h, 4)
+                                         : opts.format;
+  // The whole image is converted at once so dithering runs across tile
+  // borders without seams
+  unsigned int pixel_size = ConvertPixels(rgba, w, h, format, opts.dither);
+  if (!pixel_size) {
+    format = GPU_RGBA8;
+    pixel_size = 4;
+  }
+  bool etc1 = format == GPU_ETC1 || format == GPU_ETC1A4;
+  unsigned int pitch = w * pixel_size;
+  std::vector<unsigned char> scratch;
+
+  for (unsigned int ty = 0; ty < h; ty += LARGE_IMAGE_TILE) {
+    for (unsigned int tx = 0; tx < w; tx += LARGE_IMAGE_TILE) {
+      unsigned int tw = std::min(LARGE_IMAGE_TILE, w - tx);
+      unsigned int th = std::min(LARGE_IMAGE_TILE, h - ty);
+      unsigned int w_pow2 = GetPower2(tw);
+      unsigned int h_pow2 = GetPower2(th);
+
+      Tile *tile = new Tile;
+      if (!C3D_TexInit(&tile->tex, (u16)w_pow2, (u16)h_pow2, format)) {
+        delete tile;
+        Free();
+        return false;
+      }
+      tiles.push_back(tile);
+
+      const unsigned char *src = rgba + ty * pitch + tx * pixel_size;
+      unsigned char *dst = (unsigned char *)tile->tex.data;
+      if (etc1) {
+        // The encoder wants a tightly packed image
+        scratch.resize(tw * th * 4);
+        for (unsigned int y = 0; y < th; y++)
+          memcpy(&scratch[y * tw * 4], src + y * pitch, tw * 4);
+        ETC1::Compress(dst, scratch.data(), tw, th, w_pow2, h_pow2,
+                       format == GPU_ETC1A4,
+                       opts.etc1_high_quality ? ETC1::High : ETC1::Fast);
+      } else {
+        memset(dst, 0, tile->tex.size);
+        SwizzleRect(pixel_size, dst, src, pitch, tw, th, w_pow2, 0, 0);
+      }
+      FinalizeTexture(&tile->tex);
+
+      tile->x = tx;
+      tile->y = ty;
+      tile->subtex.width = (u16)tw;
+      tile->subtex.height = (u16)th;
+      tile->subtex.left = 0.0f;
+      tile->subtex.top = 1.0f;
+      tile->subtex.right = tw / (float)w_pow2;
+      tile->subtex.bottom = 1.0f - (th / (float)h_pow2);
+    }
+  }
+  width = w;
+  height = h;
+  return true;
+}
+
+/// Split a decoded RGBA8 image into tiles and free it, the shared part of
+/// LargeImage::LoadFile() and LoadBuffer()
+static bool LoadDecodedLargeImage(LargeImage *image, unsigned char *rgba,
+                                  int w, int h, int c,
+                                  const ImageOptions &opts) {
+  if (!rgba)
+    return false;
+  // Pick the format here where the source channel count is known
+  ImageOptions tile_opts = opts;
+  if (opts.auto_format) {
+    tile_opts.format = PickImageFormat(rgba, (unsigned int)(w * h), c);
+    tile_opts.auto_format = false;
+  }
+  bool ok = image->LoadRGBA(rgba, (unsigned int)w, (unsigned int)h, tile_opts);
+  stbi_image_free(rgba);
+  return ok;
+}
+
+bool LargeImage::LoadFile(std::string_view path, const ImageOptions &opts) {
+  int w, h, c, channels;
+  unsigned char *rgba = DecodeImageFile(std::string(path), opts, &w, &h, &c,
+                                        &channels, DecodeForRGBA);
+  return LoadDecodedLargeImage(this, rgba, w, h, c, opts);
+}
+
+bool LargeImage::LoadBuffer(BufferView buffer, const ImageOptions &opts) {
+  int w, h, c, channels;
+  unsigned char *rgba = DecodeImageMemory(buffer, opts, &w, &h, &c, &channels,
+                                          DecodeForRGBA);
+  return LoadDecodedLargeImage(this, rgba, w, h, c, opts);
+}
+
+void LargeImage::Draw(float x, float y, float sx, float sy) {
+  float screen_w = pr_context->TargetWidth;
+  float screen_h = pr_context->TargetHeight;
+  for (auto tile : tiles) {
+    float x0 = x + tile->x * sx, x1 = x0 + tile->subtex.width * sx;
+    float y0 = y + tile->y * sy, y1 = y0 + tile->subtex.height * sy;
+    if (std::max(x0, x1) <= 0 || std::min(x0, x1) >= screen_w ||
+        std::max(y0, y1) <= 0 || std::min(y0, y1) >= screen_h)
+      continue;
+    C2D_Image img = {&tile->tex, &tile->subtex};
+    C2D_DrawImageAt(img, x0, y0, 0.5f, nullptr, sx, sy);
+  }
+}
+
+/// AnimatedImage
+/// GIF frames shorter than this get the usual 100 ms, like browsers do
+static const int GIF_MIN_DELAY = 20;
+
+#if PRO_DEFINE_STB_IMAGE == 1
+/// Decodes one GIF frame per call with stb_image's frame by frame decoder,
+/// which is only reachable where the implementation gets compiled
+struct AnimatedImage::Decoder {
+  std::vector<unsigned char> file;
+  stbi__context ctx;
+  stbi__gif gif;
+  // The last two frames, GIF disposal can restore the one two back
+  std::vector<unsigned char> one_back, two_back;
+  unsigned int count = 0;
+
+  Decoder() { memset(&gif, 0, sizeof(gif)); }
+  ~Decoder() { Close(); }
+
+  void Open() {
+    Close();
+    stbi__start_mem(&ctx, file.data(), (int)file.size());
+  }
+
+  void Close() {
+    stbi_image_free(gif.out);
+    stbi_image_free(gif.history);
+    stbi_image_free(gif.background);
+    memset(&gif, 0, sizeof(gif));
+    count = 0;
+  }
+
+  /// Next frame as RGBA8 or nullptr after the last one
+  const unsigned char *Next(int *w, int *h, int *delay) {
+    int comp;
+    unsigned char *two = count >= 2 ? two_back.data() : nullptr;
+    unsigned char *out = stbi__gif_load_next(&ctx, &gif, &comp, 4, two);
+    if (!out || out == (unsigned char *)&ctx)
+      return nullptr;
+    size_t size = (size_t)gif.w * gif.h * 4;
+    two_back.swap(one_back);
+    one_back.assign(out, out + size);
+    count++;
+    *w = gif.w;
+    *h = gif.h;
+    *delay = gif.delay;
+    return out;
+  }
+};
+#else
+/// stb_image is compiled elsewhere, so its frame by frame GIF decoder can
+/// not be reached. Decode all frames up front, still into one texture.
+struct AnimatedImage::Decoder {
+  std::vector<unsigned char> file;
+  unsigned char *frames = nullptr;
+  int *delays = nullptr;
+  int w = 0, h = 0, count = 0, next = 0;
+
+  ~Decoder() {
+    stbi_image_free(frames);
+    stbi_image_free(delays);
+  }
+
+  void Open() {
+    if (!frames) {
+      int comp;
+      frames = stbi_load_gif_from_memory(file.data(), (int)file.size(),
+                                         &delays, &w, &h, &count, &comp, 4);
+    }
+    next = 0;
+  }
+
+  const unsigned char *Next(int *out_w, int *out_h, int *delay) {
+    if (!frames || next >= count)
+      return nullptr;
+    *out_w = w;
+    *out_h = h;
+    *delay = delays[next];
+    return frames + (size_t)w * h * 4 * next++;
+  }
+};
+#endif
+
+void AnimatedImage::Free() {
+  delete decoder;
+  decoder = nullptr;
+  if (tex.data)
+    C3D_TexDelete(&tex);
+  tex = {};
+  subtex = {0, 0, 0.0f, 0.0f, 0.0f, 0.0f};
+  pixels = nullptr;
+  frame = 0;
+  finished = false;
+}
+
+bool AnimatedImage::LoadFile(std::string_view path, GPU_TEXCOLOR fmt) {
+  FILE *f = fopen(std::string(path).c_str(), "rb");
+  if (!f)
+    return false;
+  std::vector<unsigned char> file;
+  if (fseek(f, 0, SEEK_END) == 0) {
+    long size = ftell(f);
+    if (size > 0 && fseek(f, 0, SEEK_SET) == 0) {
+      file.resize((size_t)size);
+      if (fread(file.data(), file.size(), 1, f) != 1)
+        file.clear();
+    }
+  }
+  fclose(f);
+  if (file.empty())
+    return false;
+
+  Free();
+  decoder = new Decoder;
+  decoder->file.swap(file);
+  return Start(fmt);
+}
+
+bool AnimatedImage::LoadBuffer(BufferView buffer, GPU_TEXCOLOR fmt) {
+  if (!buffer.data || !buffer.size)
+    return false;
+  Free();
+  decoder = new Decoder;
+  decoder->file.assign(buffer.data, buffer.data + buffer.size);
+  return Start(fmt);
+}
+
+bool AnimatedImage::Start(GPU_TEXCOLOR fmt) {
+  unsigned char probe[4] = {0, 0, 0, 0};
+  format = fmt;
+  if (fmt == GPU_ETC1 || fmt == GPU_ETC1A4 ||
+      !ConvertPixels(probe, 1, 1, fmt, DitherNone))
+    format = GPU_RGBA8;
+
+  decoder->Open();
+  int w, h, delay;
+  pixels = decoder->Next(&w, &h, &delay);
+  if (!pixels || w > 1024 || h > 1024) {
+    Free();
+    return false;
+  }
+  unsigned int w_pow2 = GetPower2(w), h_pow2 = GetPower2(h);
+  if (!C3D_TexInit(&tex, (u16)w_pow2, (u16)h_pow2, format)) {
+    Free();
+    return false;
+  }
+  memset(tex.data, 0, tex.size);
+  FinalizeTexture(&tex);
+
+  subtex.width = (u16)w;
+  subtex.height = (u16)h;
+  subtex.left = 0.0f;
+  subtex.top = 1.0f;
+  subtex.right = w / (float)w_pow2;
+  subtex.bottom = 1.0f - (h / (float)h_pow2);
+
+  time_left = (float)(delay < GIF_MIN_DELAY ? 100 : delay);
+  ConvertStrips((unsigned char *)tex.data, (unsigned char *)pixels, 4,
+                subtex.width, subtex.height, tex.width, format, DitherNone,
+                true);
+  C3D_TexFlush(&tex);
+  return true;
+}
+
+/// Step to the next frame, wrapping around when looping
+bool AnimatedImage::DecodeFrame() {
+  int w, h, delay;
+  const unsigned char *next = decoder->Next(&w, &h, &delay);
+  if (next) {
+    frame++;
+  } else {
+    if (!looping || frame == 0) {
+      finished = true;
+      return false;
+    }
+    decoder->Open();
+    next = decoder->Next(&w, &h, &delay);
+    if (!next)
+      return false;
+    frame = 0;
+  }
+  pixels = next;
+  time_left += (float)(delay < GIF_MIN_DELAY ? 100 : delay);
+  return true;
+}
 
-void DeleteFont(C2D_Font font) { C2D_FontFree(font); }
+void AnimatedImage::Update(float seconds) {
+  if (!decoder || finished)
+    return;
+  time_left -= seconds * 1000.0f;
+  // Every frame has to be decoded since GIF frames build on each other,
+  // but only the last one due gets uploaded
+  bool changed = false;
+  while (time_left <= 0 && DecodeFrame())
+    changed = true;
+  if (!changed)
+    return;
+  ConvertStrips((unsigned char *)tex.data, (unsigned char *)pixels, 4,
+                subtex.width, subtex.height, tex.width, format, DitherNone,
+                true);
+  C3D_TexFlush(&tex);
+}
+
+void AnimatedImage::Draw(float x, float y, float sx, float sy) {
+  if (!tex.data)
+    return;
+  C2D_DrawImageAt(GetImage(), x, y, 0.5f, nullptr, sx, sy);
+}
 
-C2D_Image LoadImageFile(std::string path) {
-  return privLoadImageFile(path.c_str());
+/// RenderTexture
+RenderTexture::RenderTexture(unsigned int width, unsigned int height) {
+  Create(width, height);
 }
 
-C2D_Image LoadImageBuffer(std::vector<unsigned char> buffer) {
-  return privLoadImageBuffer(buffer);
+bool RenderTexture::Create(unsigned int width, unsigned int height) {
+  Free();
+  if (!width || !height || width > 1024 || height > 1024)
+    return false;
+  // The GPU renders into it, so it has to live in VRAM
+  unsigned int w_pow2 = GetPower2(width), h_pow2 = GetPower2(height);
+  if (!C3D_TexInitVRAM(&tex, (u16)w_pow2, (u16)h_pow2, GPU_RGBA8))
+    return false;
+  // 2D drawing does not depth test, so no depth buffer is attached
+  target = C3D_RenderTargetCreateFromTex(&tex, GPU_TEXFACE_2D, 0,
+                                         (GPU_DEPTHBUF)-1);
+  if (!target) {
+    C3D_TexDelete(&tex);
+    return false;
+  }
+  C3D_TexSetFilter(&tex, GPU_NEAREST, GPU_NEAREST);
+  tex.border = 0x00000000;
+  C3D_TexSetWrap(&tex, GPU_CLAMP_TO_BORDER, GPU_CLAMP_TO_BORDER);
+
+  subtex.width = (u16)width;
+  subtex.height = (u16)height;
+  subtex.left = 0.0f;
+  subtex.top = 1.0f;
+  subtex.right = width / (float)w_pow2;
+  subtex.bottom = 1.0f - height / (float)h_pow2;
+  Clear();
+  return true;
 }
 
-void GetTextSize(std::string text, float size, float *width, float *height,
+void RenderTexture::Free() {
+  if (!target)
+    return;
+  C3D_RenderTargetDelete(target);
+  C3D_TexDelete(&tex);
+  target = nullptr;
+  tex = {};
+  subtex = {0, 0, 0.0f, 0.0f, 0.0f, 0.0f};
+}
+
+void RenderTexture::Clear(unsigned int color) {
+  if (target)
+    C2D_TargetClear(target, color);
+}
+
+/// SpriteSheet
+SpriteSheet::SpriteSheet(C2D_Image image, unsigned int frame_w,
+                         unsigned int frame_h, unsigned int count)
+    : image(image) {
+  if (!image.subtex || !frame_w || !frame_h)
+    return;
+  unsigned int cols = image.subtex->width / frame_w;
+  unsigned int rows = image.subtex->height / frame_h;
+  if (!count || count > cols * rows)
+    count = cols * rows;
+  frames.reserve(count);
+  for (unsigned int i = 0; i < count; i++)
+    AddFrame({(i % cols) * frame_w, (i / cols) * frame_h, frame_w, frame_h});
+}
+
+SpriteSheet::SpriteSheet(C2D_Image image, const std::vector<FrameRect> &rects)
+    : image(image) {
+  if (!image.subtex)
+    return;
+  frames.reserve(rects.size());
+  for (auto &rect : rects)
+    AddFrame(rect);
+}
+
+void SpriteSheet::AddFrame(const FrameRect &rect) {
+  // Map pixels of the image to its part of the texture, which also works
+  // for images inside an atlas
+  const Tex3DS_SubTexture *src = image.subtex;
+  float u = (src->right - src->left) / src->width;
+  float v = (src->bottom - src->top) / src->height;
+
+  Tex3DS_SubTexture frame;
+  frame.width = (u16)rect.w;
+  frame.height = (u16)rect.h;
+  frame.left = src->left + rect.x * u;
+  frame.top = src->top + rect.y * v;
+  frame.right = src->left + (rect.x + rect.w) * u;
+  frame.bottom = src->top + (rect.y + rect.h) * v;
+  frames.push_back(frame);
+}
+
+C2D_Image SpriteSheet::GetFrame(size_t index) const {
+  if (index >= frames.size())
+    return C2D_Image();
+  C2D_Image frame;
+  frame.tex = image.tex;
+  frame.subtex = &frames[index];
+  return frame;
+}
+
+void SpriteSheet::DrawFrame(size_t index, float x, float y, float sx,
+                            float sy) const {
+  if (index >= frames.size())
+    return;
+  DrawImage(GetFrame(index), x, y, sx, sy);
+}
+
+void SetImageCacheDir(std::string_view path) {
+  if (!path.empty()) {
+    std::error_code ec;
+    std::filesystem::create_directories(path, ec);
+  }
+  pr_image_cache_dir = path;
+}
+
+TextCacheStats GetTextCacheStats() {
+  TextCacheStats stats;
+  stats.hits = pr_text_cache.hits;
+  stats.misses = pr_text_cache.misses;
+  if (pr_text_cache.buf)
+    stats.glyphs = C2D_TextBufGetNumGlyphs(pr_text_cache.buf);
+  return stats;
+}
+
+void SetTextCacheSize(size_t glyphs) {
+  pr_text_cache.capacity = glyphs;
+  ResetTextCache();
+}
+
+void GetTextSize(std::string_view text, float size, float *width, float *height,
                  C2D_Font fnt) {
-  C2D_Text c2d_text;
-  if (fnt != nullptr)
-    C2D_TextFontParse(&c2d_text, fnt, pr_context->TextBuffer, text.c_str());
-  else
-    C2D_TextFontParse(&c2d_text, pr_context->DefaultFont,
-                      pr_context->TextBuffer, text.c_str());
-  C2D_TextGetDimensions(&c2d_text, size, size, width, height);
+  if (!fnt)
+    fnt = pr_context->DefaultFont;
+  const TextMetrics *m = MeasureText(text, fnt);
+  // Same as C2D_TextGetDimensions
+  if (width)
+    *width = size * m->width;
+  if (height)
+    *height = ceilf(size * C2D_FontGetInfo(fnt)->lineFeed) * m->lines;
 }
 
-float GetTextWidth(std::string text, float size, C2D_Font fnt) {
+float GetTextWidth(std::string_view text, float size, C2D_Font fnt) {
   float width = 0;
   if (fnt != nullptr)
     GetTextSize(text, size, &width, nullptr, fnt);
@@ -267,7 +2514,7 @@ float GetTextWidth(std::string text, float size, C2D_Font fnt) {
   return width;
 }
 
-float GetTextHeight(std::string text, float size, C2D_Font fnt) {
+float GetTextHeight(std::string_view text, float size, C2D_Font fnt) {
   float height = 0;
   if (fnt != nullptr)
     GetTextSize(text, size, nullptr, &height, fnt);
@@ -281,11 +2528,31 @@ void DrawRect(float x, float y, float w, float h, unsigned int color) {
 }
 
 void DrawImage(C2D_Image img, float x, float y, float sx, float sy) {
+  TextureEntry *e = TouchTexture(img.tex);
+  if ((e && !e->resident) || (img.tex && !img.tex->data))
+    return;
+  // Only the image as loaded is trimmed, not sub rects of it
+  if (e && img.subtex == e->subtex) {
+    x += e->subtex->trim_left * sx;
+    y += e->subtex->trim_top * sy;
+  }
   C2D_DrawImageAt(img, x, y, 0.5f, nullptr, sx, sy);
 }
 
 void DrawImageRotated(C2D_Image img, float a, float x, float y, float sx,
                       float sy) {
+  TextureEntry *e = TouchTexture(img.tex);
+  if ((e && !e->resident) || (img.tex && !img.tex->data))
+    return;
+  if (e && img.subtex == e->subtex) {
+    // x, y is the center of the full image, move the trimmed one off it
+    const ImageSubTexture *s = e->subtex;
+    float dx = (s->trim_left - s->trim_right) * 0.5f * sx;
+    float dy = (s->trim_top - s->trim_bottom) * 0.5f * sy;
+    float c = cosf(a), si = sinf(a);
+    x += dx * c - dy * si;
+    y += dx * si + dy * c;
+  }
   C2D_DrawImageAtRotated(img, x, y, 0.5, a, nullptr, sx, sy);
 }
 
@@ -317,144 +2584,39 @@ void DrawTriangle(float x0, float y0, unsigned int clr0, float x1, float y1,
   C2D_DrawTriangle(x0, y0, clr0, x1, y1, clr1, x2, y2, clr2, 0.5);
 }
 
-void DrawText(std::string text, float size, float x, float y,
+void DrawText(std::string_view text, float size, float x, float y,
               unsigned int color, float maxW, float maxH, C2D_Font fnt) {
-  C2D_Text c2d_text;
-
-  if (fnt != nullptr) {
-    C2D_TextFontParse(&c2d_text, fnt, pr_context->TextBuffer, text.c_str());
-  } else {
-    C2D_TextFontParse(&c2d_text, pr_context->DefaultFont,
-                      pr_context->TextBuffer, text.c_str());
-  }
-
-  C2D_TextOptimize(&c2d_text);
-
-  float heightScale;
-  if (maxH == 0) {
-    heightScale = size;
-  } else {
-    if (fnt != nullptr) {
-      heightScale = std::min(
-          size, size * (maxH / ProRender::GetTextHeight(text, size, fnt)));
-    } else {
-      heightScale =
-          std::min(size, size * (maxH / ProRender::GetTextHeight(text, size)));
-    }
-  }
-
-  if (maxW == 0) {
-    C2D_DrawText(&c2d_text, C2D_WithColor, x, y, 0.5f, size, heightScale,
-                 color);
-  } else {
-    if (fnt != nullptr) {
-      C2D_DrawText(&c2d_text, C2D_WithColor, x, y, 0.5f,
-                   std::min(size, size * (maxW / ProRender::GetTextWidth(
-                                                     text, size, fnt))),
-                   heightScale, color);
-    } else {
-      C2D_DrawText(
-          &c2d_text, C2D_WithColor, x, y, 0.5f,
-          std::min(size, size * (maxW / ProRender::GetTextWidth(text, size))),
-          heightScale, color);
-    }
-  }
+  C2D_Text scratch;
+  const C2D_Text *c2d_text = GetText(text, fnt, &scratch);
+
+  // Fit into maxW x maxH with the dimensions of the text parsed for drawing
+  float width = 0, height = 0;
+  if (maxW != 0 || maxH != 0)
+    C2D_TextGetDimensions(c2d_text, size, size, &width, &height);
+  float widthScale = size, heightScale = size;
+  if (maxW != 0)
+    widthScale = std::min(size, size * (maxW / width));
+  if (maxH != 0)
+    heightScale = std::min(size, size * (maxH / height));
+
+  C2D_DrawText(c2d_text, C2D_WithColor, x, y, 0.5f, widthScale, heightScale,
+               color);
 }
 
-void DrawTextCentered(std::string text, float size, float x, float y,
+void DrawTextCentered(std::string_view text, float size, float x, float y,
                       unsigned int color, float maxW, float maxH,
                       C2D_Font fnt) {
-  float lineHeight, widthScale;
-
-  // Check for the lineHeight.
-  if (fnt != nullptr) {
-    lineHeight = ProRender::GetTextHeight(" ", size, fnt);
-  } else {
-    lineHeight = ProRender::GetTextHeight(" ", size);
-  }
-
-  int line = 0;
-  while (text.find('\n') != text.npos) {
-    if (maxW == 0) {
-      // Do the widthScale.
-      if (fnt != nullptr) {
-        widthScale =
-            ProRender::GetTextWidth(text.substr(0, text.find('\n')), size, fnt);
-      } else {
-        widthScale =
-            ProRender::GetTextWidth(text.substr(0, text.find('\n')), size);
-      }
-    } else {
-      // Do the widthScale 2.
-      if (fnt != nullptr) {
-        widthScale = std::min((float)maxW,
-                              ProRender::GetTextWidth(
-                                  text.substr(0, text.find('\n')), size, fnt));
-      } else {
-        widthScale = std::min(
-            (float)maxW,
-            ProRender::GetTextWidth(text.substr(0, text.find('\n')), size));
-      }
-    }
-    if (fnt != nullptr) {
-      ProRender::DrawText(text.substr(0, text.find('\n')), size,
-                          (pr_context->IsTopNow ? 200 : 160) + x -
-                              (widthScale / 2),
-                          y + (lineHeight * line), color, maxW, maxH, fnt);
-    } else {
-      ProRender::DrawText(text.substr(0, text.find('\n')), size,
-                          (pr_context->IsTopNow ? 200 : 160) + x -
-                              (widthScale / 2),
-                          y + (lineHeight * line), color, maxW, maxH);
-    }
-
-    text = text.substr(text.find('\n') + 1);
-    line++;
-  }
-
-  if (maxW == 0) {
-    // Do the next WidthScale.
-    if (fnt != nullptr) {
-      widthScale =
-          ProRender::GetTextWidth(text.substr(0, text.find('\n')), size, fnt);
-    } else {
-      widthScale =
-          ProRender::GetTextWidth(text.substr(0, text.find('\n')), size);
-    }
-  } else {
-    // And again.
-    if (fnt != nullptr) {
-      widthScale = std::min(
-          (float)maxW,
-          ProRender::GetTextWidth(text.substr(0, text.find('\n')), size, fnt));
-    } else {
-      widthScale = std::min(
-          (float)maxW,
-          ProRender::GetTextWidth(text.substr(0, text.find('\n')), size));
-    }
-  }
-  if (fnt != nullptr) {
-    ProRender::DrawText(text.substr(0, text.find('\n')), size,
-                        (pr_context->IsTopNow ? 200 : 160) + x -
-                            (widthScale / 2),
-                        y + (lineHeight * line), color, maxW, maxH, fnt);
-  } else {
-    ProRender::DrawText(text.substr(0, text.find('\n')), size,
-                        (pr_context->IsTopNow ? 200 : 160) + x -
-                            (widthScale / 2),
-                        y + (lineHeight * line), color, maxW, maxH);
-  }
+  DrawTextLines(text, size, x, y, color, maxW, maxH, fnt,
+                pr_context->TargetWidth / 2, 0.5f);
 }
 
-void DrawTextRight(std::string text, float size, float x, float y,
+void DrawTextRight(std::string_view text, float size, float x, float y,
                    unsigned int color, float maxW, float maxH, C2D_Font fnt) {
-  ProRender::DrawText(text, size,
-                      (pr_context->IsTopNow ? 400 : 320) -
-                          ProRender::GetTextWidth(text, size, fnt) - x,
-                      y, color, maxW, maxH, fnt);
+  DrawTextLines(text, size, -x, y, color, maxW, maxH, fnt,
+                pr_context->TargetWidth, 1.0f);
 }
 
-void DrawTextWBG(std::string text, float size, float x, float y,
+void DrawTextWBG(std::string_view text, float size, float x, float y,
                  unsigned int color, unsigned int bgcolor, float maxW,
                  float maxH, C2D_Font fnt) {
   ProRender::DrawRect(x, y, ProRender::GetTextWidth(text, size),
@@ -462,15 +2624,15 @@ void DrawTextWBG(std::string text, float size, float x, float y,
   ProRender::DrawText(text, size, x, y, color, maxW, maxH, fnt);
 }
 
-void DrawTextRightWBG(std::string text, float size, float x, float y,
+void DrawTextRightWBG(std::string_view text, float size, float x, float y,
                       unsigned int color, unsigned int bgcolor, float maxW,
                       float maxH, C2D_Font fnt) {
-  ProRender::DrawRect((pr_context->IsTopNow ? 400 : 320) -
+  ProRender::DrawRect(pr_context->TargetWidth -
                           ProRender::GetTextWidth(text, size, fnt) - x,
                       y, ProRender::GetTextWidth(text, size),
                       ProRender::GetTextHeight(text, size), bgcolor);
   ProRender::DrawText(text, size,
-                      (pr_context->IsTopNow ? 400 : 320) -
+                      pr_context->TargetWidth -
                           ProRender::GetTextWidth(text, size, fnt) - x,
                       y, color, maxW, maxH, fnt);
 }
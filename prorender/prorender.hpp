@@ -20,7 +20,10 @@
 #define PRO_DEFINE_STB_IMAGE 1
 
 // cxx includes
+#include <deque>
+#include <memory>
 #include <string>
+#include <string_view>
 #include <vector>
 
 // 3ds includes
@@ -45,21 +48,303 @@ void StartDrawOn(RenderTarget target);
 unsigned int FastColor32(unsigned char r, unsigned char g, unsigned char b,
                          unsigned char a = 255);
 unsigned int FastColorF(float r, float g, float b, float a = 1.0f);
-unsigned int FastColorHex(std::string hex_str, unsigned char a = 255);
+unsigned int FastColorHex(std::string_view hex_str, unsigned char a = 255);
 
 // FontLoading
-C2D_Font LoadFont(std::string path);
+C2D_Font LoadFont(std::string_view path);
 void DeleteFont(C2D_Font font);
 
 // Image Loading
-C2D_Image LoadImageFile(std::string path);
-C2D_Image LoadImageBuffer(std::vector<unsigned char> buffer);
+enum ImageDither {
+  DitherNone = 0,          //< Plain rounding
+  DitherOrdered = 1,       //< 4x4 Bayer matrix
+  DitherFloydSteinberg = 2 //< Error diffusion
+};
+struct ImageOptions {
+  /// Texture format: GPU_RGBA8, GPU_RGB8, GPU_RGB565, GPU_RGBA5551,
+  /// GPU_RGBA4, GPU_LA8, GPU_L8, GPU_A8, GPU_ETC1 or GPU_ETC1A4
+  GPU_TEXCOLOR format = GPU_RGBA8;
+  /// Pick the smallest format that keeps the image intact (ignores format)
+  bool auto_format = false;
+  /// Dithering used when reducing to a 16 bit format
+  ImageDither dither = DitherNone;
+  /// Slower ETC1 compression searching more base colors
+  bool etc1_high_quality = false;
+  /// Shrink images larger than this by an integer factor while loading.
+  /// 0 refuses images over 1024 instead, larger values are capped to 1024.
+  unsigned int max_size = 0;
+  /// Build a full mip chain and filter linearly, for images that get drawn
+  /// scaled down
+  bool mipmaps = false;
+  /// Crop fully transparent margins. DrawImage and DrawImageRotated place
+  /// the rest where it was in the full image.
+  bool trim_alpha = false;
+};
+C2D_Image LoadImageFile(std::string_view path,
+                        const ImageOptions &opts = ImageOptions());
+/// Non-owning view of an encoded image in memory
+struct BufferView {
+  const unsigned char *data = nullptr;
+  size_t size = 0;
+
+  BufferView() = default;
+  BufferView(const unsigned char *data, size_t size) : data(data), size(size) {}
+  BufferView(const std::vector<unsigned char> &buffer)
+      : data(buffer.data()), size(buffer.size()) {}
+};
+/// Decode straight from the caller's memory, nothing gets copied
+C2D_Image LoadImageBuffer(BufferView buffer,
+                          const ImageOptions &opts = ImageOptions());
+C2D_Image LoadImageBuffer(const unsigned char *data, size_t size,
+                          const ImageOptions &opts = ImageOptions());
+/// Takes over the buffer and frees it as soon as it is decoded
+C2D_Image LoadImageBuffer(std::vector<unsigned char> &&buffer,
+                          const ImageOptions &opts = ImageOptions());
+/// Load many images at once, decoding is spread across all CPU cores. The
+/// result has the same order as `paths`, failed loads have tex == nullptr.
+std::vector<C2D_Image>
+LoadImageFiles(const std::vector<std::string> &paths,
+               const ImageOptions &opts = ImageOptions());
+/// Loading the same file (or the same buffer contents) with the same
+/// options again returns the already loaded image with another reference.
+struct ImageCacheStats {
+  unsigned int hits = 0;   //< Loads served by an already loaded image
+  unsigned int misses = 0; //< Loads that decoded a new image
+};
+ImageCacheStats GetImageCacheStats();
+/// Release an image returned by the Load functions. The texture is freed
+/// once every load that returned it has been released.
+void DeleteImage(C2D_Image img);
+/// Overwrite the width x height rect at (x, y) of a loaded image with RGBA8
+/// pixels, only the tiles it touches get swizzled and flushed. `width` and
+/// `height` are the size of the source, parts past the image are clipped.
+/// `pitch` is the bytes per source row (0 = width * 4). Images loaded with
+/// trim_alpha are addressed untrimmed like DrawImage, pixels that fall in
+/// the cut off margins are dropped. Fails for ETC1 images, an updated image
+/// is no longer shared or evicted and its mipmaps keep their old content.
+bool UpdateImageRect(C2D_Image img, const unsigned char *rgba, unsigned int x,
+                     unsigned int y, unsigned int width, unsigned int height,
+                     unsigned int pitch = 0);
+/// Limit the linear memory used by loaded textures (0 = unlimited). Least
+/// recently drawn file textures get evicted and reloaded when drawn again.
+void SetTextureBudget(size_t bytes);
+/// Bytes of linear memory currently held by loaded textures
+size_t GetTextureMemoryUsed();
+/// Cache converted textures of LoadImageFile in this directory so later
+/// loads skip decoding. Empty string (default) disables the cache.
+void SetImageCacheDir(std::string_view path);
+
+// Async Image Loading
+/// State of an image that is loaded in the background
+struct ImageLoad {
+  bool done = false;                    //< Set by PollLoads when finished
+  C2D_Image image = {nullptr, nullptr}; //< tex is nullptr if loading failed
+};
+using ImageLoadHandle = std::shared_ptr<ImageLoad>;
+/// Decode and convert on a worker thread, the returned handle is completed
+/// by PollLoads. If the worker thread cannot be started the file is loaded
+/// right away and the handle is returned already done.
+ImageLoadHandle LoadImageFileAsync(std::string_view path,
+                                   const ImageOptions &opts = ImageOptions());
+/// Upload finished async loads, call once per frame on the render thread
+void PollLoads();
+
+// Texture Atlas
+/// Packs many small images into shared size x size textures (skyline
+/// packing) so they cost neither a texture of their own nor a texture
+/// switch per draw. Returned images stay valid as long as the atlas lives.
+class TextureAtlas {
+public:
+  TextureAtlas(unsigned int size = 512, GPU_TEXCOLOR format = GPU_RGBA8);
+  ~TextureAtlas();
+  TextureAtlas(const TextureAtlas &) = delete;
+  TextureAtlas &operator=(const TextureAtlas &) = delete;
+
+  C2D_Image AddImageFile(std::string_view path);
+  C2D_Image AddImageBuffer(BufferView buffer);
+  /// Add raw RGBA8 pixels, the buffer is used as scratch space
+  C2D_Image AddImageRGBA(unsigned char *rgba, unsigned int width,
+                         unsigned int height);
+  /// Number of textures used so far
+  size_t GetPageCount() const { return pages.size(); }
+
+  struct Page;
+
+private:
+  unsigned int size;
+  GPU_TEXCOLOR format;
+  unsigned int pixel_size;
+  std::vector<Page *> pages;
+  std::deque<Tex3DS_SubTexture> subtextures;
+};
+
+// Large Images
+/// An image bigger than the 1024x1024 texture limit, split into a grid of
+/// textures. Tiles outside the screen are skipped when drawing. Of the
+/// ImageOptions, max_size shrinks the whole image and is not capped to
+/// 1024, mipmaps and trim_alpha are not supported and ignored.
+class LargeImage {
+public:
+  LargeImage() = default;
+  ~LargeImage() { Free(); }
+  LargeImage(const LargeImage &) = delete;
+  LargeImage &operator=(const LargeImage &) = delete;
+
+  bool LoadFile(std::string_view path,
+                const ImageOptions &opts = ImageOptions());
+  bool LoadBuffer(BufferView buffer, const ImageOptions &opts = ImageOptions());
+  /// Build from raw RGBA8 pixels, the buffer is used as scratch space
+  bool LoadRGBA(unsigned char *rgba, unsigned int width, unsigned int height,
+                const ImageOptions &opts = ImageOptions());
+  void Free();
+
+  unsigned int GetWidth() const { return width; }
+  unsigned int GetHeight() const { return height; }
+  size_t GetTileCount() const { return tiles.size(); }
+
+  void Draw(float x = 0, float y = 0, float sx = 1.0f, float sy = 1.0f);
+
+  struct Tile;
+
+private:
+  unsigned int width = 0;
+  unsigned int height = 0;
+  std::vector<Tile *> tiles;
+};
+
+// Sprite Sheets
+/// Rect of a frame in pixels of the image
+struct FrameRect {
+  unsigned int x, y, w, h;
+};
+/// Frames cut out of one loaded image. They all share its texture, so
+/// nothing gets loaded and drawing them does not switch textures. The image
+/// has to stay loaded while the sheet is used. Images loaded with
+/// trim_alpha are not supported.
+class SpriteSheet {
+public:
+  SpriteSheet() = default;
+  /// Grid of frame_w x frame_h cells read row by row, `count` = 0 takes
+  /// every full cell
+  SpriteSheet(C2D_Image image, unsigned int frame_w, unsigned int frame_h,
+              unsigned int count = 0);
+  SpriteSheet(C2D_Image image, const std::vector<FrameRect> &rects);
+
+  size_t GetFrameCount() const { return frames.size(); }
+  /// Image of one frame, valid as long as the sheet lives
+  C2D_Image GetFrame(size_t index) const;
+  void DrawFrame(size_t index, float x = 0, float y = 0, float sx = 1.0f,
+                 float sy = 1.0f) const;
+
+private:
+  void AddFrame(const FrameRect &rect);
+
+  C2D_Image image = {nullptr, nullptr};
+  std::vector<Tex3DS_SubTexture> frames;
+};
+
+// Animated Images
+/// Animated GIF played through one texture that gets reused for every
+/// frame. Frames are decoded one at a time when they are due.
+class AnimatedImage {
+public:
+  AnimatedImage() = default;
+  ~AnimatedImage() { Free(); }
+  AnimatedImage(const AnimatedImage &) = delete;
+  AnimatedImage &operator=(const AnimatedImage &) = delete;
+
+  bool LoadFile(std::string_view path, GPU_TEXCOLOR format = GPU_RGBA8);
+  bool LoadBuffer(BufferView buffer, GPU_TEXCOLOR format = GPU_RGBA8);
+  void Free();
+
+  /// Advance the animation by `seconds` and upload the frame that is due.
+  /// Call after NewFrame, before drawing.
+  void Update(float seconds);
+  void SetLooping(bool loop) { looping = loop; }
+  /// Current frame, the image stays the same for every frame
+  C2D_Image GetImage() { return {&tex, &subtex}; }
+  void Draw(float x = 0, float y = 0, float sx = 1.0f, float sy = 1.0f);
+
+  unsigned int GetWidth() const { return subtex.width; }
+  unsigned int GetHeight() const { return subtex.height; }
+  unsigned int GetFrameIndex() const { return frame; }
+  bool IsFinished() const { return finished; }
+
+  struct Decoder;
+
+private:
+  bool Start(GPU_TEXCOLOR format);
+  bool DecodeFrame();
+
+  Decoder *decoder = nullptr;
+  C3D_Tex tex = {};
+  Tex3DS_SubTexture subtex = {0, 0, 0.0f, 0.0f, 0.0f, 0.0f};
+  GPU_TEXCOLOR format = GPU_RGBA8;
+  const unsigned char *pixels = nullptr; //< Decoded current frame, RGBA8
+  unsigned int frame = 0;
+  float time_left = 0; //< Milliseconds until the next frame
+  bool looping = true;
+  bool finished = false;
+};
+
+// Render Textures
+/// Offscreen target backed by a texture. Draw into it with StartDrawOn and
+/// then draw GetImage() every frame instead of redrawing what it holds.
+/// The content stays until it gets cleared or drawn over.
+class RenderTexture {
+public:
+  RenderTexture() = default;
+  /// Same as Create()
+  RenderTexture(unsigned int width, unsigned int height);
+  ~RenderTexture() { Free(); }
+  RenderTexture(const RenderTexture &) = delete;
+  RenderTexture &operator=(const RenderTexture &) = delete;
+
+  /// Allocate a width x height (max 1024) RGBA8 target in VRAM, cleared to
+  /// transparent
+  bool Create(unsigned int width, unsigned int height);
+  /// Only free a target that is not drawn to or drawn in the current frame
+  void Free();
+  bool IsValid() const { return target != nullptr; }
+  /// Clear to `color` before the next draw into it
+  void Clear(unsigned int color = 0x00000000);
+  C2D_Image GetImage() { return {&tex, &subtex}; }
+
+  unsigned int GetWidth() const { return subtex.width; }
+  unsigned int GetHeight() const { return subtex.height; }
+
+private:
+  friend void StartDrawOn(RenderTexture &target);
+
+  C3D_Tex tex = {};
+  Tex3DS_SubTexture subtex = {0, 0, 0.0f, 0.0f, 0.0f, 0.0f};
+  C3D_RenderTarget *target = nullptr;
+};
+/// Draw the following calls into a render texture, coordinates are pixels
+/// of the texture and centered or right aligned text uses its width
+void StartDrawOn(RenderTexture &target);
+
+// Text Cache
+/// Parsed text is kept between frames, keyed by string and font, so labels
+/// that do not change skip glyph parsing. Counts are since the last
+/// NewFrame.
+struct TextCacheStats {
+  unsigned int hits = 0;   //< Draws and measurements of already parsed text
+  unsigned int misses = 0; //< Texts that had to be parsed
+  size_t glyphs = 0;       //< Glyphs held by the cache
+};
+TextCacheStats GetTextCacheStats();
+/// Glyph capacity of the text cache (default 8192), 0 disables it. Drops
+/// everything cached, call it outside of drawing.
+void SetTextCacheSize(size_t glyphs);
 
 // TextSizeFunctions
-void GetTextSize(std::string text, float size, float *width, float *height,
-                 C2D_Font fnt = nullptr);
-float GetTextWidth(std::string text, float size, C2D_Font fnt = nullptr);
-float GetTextHeight(std::string text, float size, C2D_Font fnt = nullptr);
+/// Measured from the font's glyph metrics without parsing into a text
+/// buffer, repeated strings are looked up
+void GetTextSize(std::string_view text, float size, float *width,
+                 float *height, C2D_Font fnt = nullptr);
+float GetTextWidth(std::string_view text, float size, C2D_Font fnt = nullptr);
+float GetTextHeight(std::string_view text, float size, C2D_Font fnt = nullptr);
 
 // Drawing
 void DrawRect(float x, float y, float w, float h, unsigned int color);
@@ -79,21 +364,21 @@ void DrawTriangle(float x0, float y0, unsigned int clr0, float x1, float y1,
                   unsigned int clr1, float x2, float y2, unsigned int clr2);
 
 // TextDrawing
-void DrawText(std::string text, float size, float x, float y,
+void DrawText(std::string_view text, float size, float x, float y,
               unsigned int color, float maxW = 0, float maxH = 0,
               C2D_Font fnt = nullptr);
-void DrawTextCentered(std::string text, float size, float x, float y,
+void DrawTextCentered(std::string_view text, float size, float x, float y,
                       unsigned int color, float maxW = 0, float maxH = 0,
                       C2D_Font fnt = nullptr);
-void DrawTextRight(std::string text, float size, float x, float y,
+void DrawTextRight(std::string_view text, float size, float x, float y,
                    unsigned int color, float maxW = 0, float maxH = 0,
                    C2D_Font fnt = nullptr);
 
 // Extras
-void DrawTextWBG(std::string text, float size, float x, float y,
+void DrawTextWBG(std::string_view text, float size, float x, float y,
                  unsigned int color, unsigned int bgcolor, float maxW = 0,
                  float maxH = 0, C2D_Font fnt = nullptr);
-void DrawTextRightWBG(std::string text, float size, float x, float y,
+void DrawTextRightWBG(std::string_view text, float size, float x, float y,
                       unsigned int color, unsigned int bgcolor, float maxW = 0,
                       float maxH = 0, C2D_Font fnt = nullptr);
 } // namespace ProRender
\ No newline at end of file
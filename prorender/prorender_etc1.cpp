@@ -0,0 +1,364 @@
+/**____            ____                _
+ *|  _ \ _ __ ___ |  _ \ ___ _ __   __| | ___ _ __
+ *| |_) | '__/ _ \| |_) / _ \ '_ \ / _` |/ _ \ '__|
+ *|  __/| | | (_) |  _ <  __/ | | | (_| |  __/ |
+ *|_|   |_|  \___/|_| \_\___|_| |_|\__,_|\___|_|
+ *
+ * _   _ ____ ___      ____ _____
+ *| \ | |  _ \_ _|    |  _ \___  |
+ *|  \| | |_) | |_____| | | | / /
+ *| |\  |  __/| |_____| |_| |/ /
+ *|_| \_|_|  |___|    |____//_/
+ *
+ *  C2D Render Helper - ETC1 Encoder
+ *  Copyright (C) 2023 NPI-D7
+ */
+
+#include <prorender_etc1.hpp>
+
+#include <climits>
+#include <cmath>
+#include <cstdint>
+
+namespace ProRender {
+namespace ETC1 {
+/// Intensity modifier tables, selectors 0..3 are +a, +b, -a, -b
+static const int MODIFIERS[8][2] = {{2, 8},   {5, 17},  {9, 29},  {13, 42},
+                                    {18, 60}, {24, 80}, {33, 106}, {47, 183}};
+
+static inline int Clamp(int v) { return v < 0 ? 0 : (v > 255 ? 255 : v); }
+
+static inline int Modifier(int table, int selector) {
+  int m = MODIFIERS[table][selector & 1];
+  return (selector & 2) ? -m : m;
+}
+
+static inline int Expand4(int c) { return (c << 4) | c; }
+static inline int Expand5(int c) { return (c << 3) | (c >> 2); }
+
+/// Pixels of a 4x4 block, indexed x * 4 + y like the ETC1 selector bits
+struct Block {
+  int px[16][4];
+};
+
+/// Pixel indices of the two subblocks for flip = 0 (2x4) and flip = 1 (4x2)
+struct SubBlocks {
+  int idx[2][2][8];
+  SubBlocks() {
+    for (int flip = 0; flip < 2; flip++) {
+      int n[2] = {0, 0};
+      for (int i = 0; i < 16; i++) {
+        int x = i >> 2, y = i & 3;
+        int s = flip ? (y >= 2) : (x >= 2);
+        idx[flip][s][n[s]++] = i;
+      }
+    }
+  }
+};
+
+static const SubBlocks SUB_BLOCKS;
+
+struct SubBlockFit {
+  int error = INT_MAX;
+  int table = 0;
+  int selectors[8] = {0};
+};
+
+/// Best table and selectors of one subblock for an expanded base color.
+/// Fast mode picks the selector nearest to the mean channel offset, which
+/// is exact as long as nothing clamps.
+static void FitSubBlock(const Block &blk, const int *members, const int *base,
+                        Quality quality, SubBlockFit *out) {
+  for (int t = 0; t < 8; t++) {
+    int error = 0;
+    int selectors[8];
+    for (int i = 0; i < 8 && error < out->error; i++) {
+      const int *p = blk.px[members[i]];
+      int best_s = 0, best_e = INT_MAX;
+      if (quality == Fast) {
+        int d = (p[0] - base[0]) + (p[1] - base[1]) + (p[2] - base[2]);
+        int a = MODIFIERS[t][0] * 3, b = MODIFIERS[t][1] * 3;
+        int mag = d < 0 ? -d : d;
+        best_s = ((mag - a) < (b - mag) ? 0 : 1) | (d < 0 ? 2 : 0);
+        best_e = 0;
+        for (int c = 0; c < 3; c++) {
+          int e = Clamp(base[c] + Modifier(t, best_s)) - p[c];
+          best_e += e * e;
+        }
+      } else {
+        for (int s = 0; s < 4; s++) {
+          int m = Modifier(t, s), e = 0;
+          for (int c = 0; c < 3; c++) {
+            int d = Clamp(base[c] + m) - p[c];
+            e += d * d;
+          }
+          if (e < best_e) {
+            best_e = e;
+            best_s = s;
+          }
+        }
+      }
+      selectors[i] = best_s;
+      error += best_e;
+    }
+    if (error < out->error) {
+      out->error = error;
+      out->table = t;
+      for (int i = 0; i < 8; i++)
+        out->selectors[i] = selectors[i];
+    }
+  }
+}
+
+/// Quantized base color candidates around the subblock average. Fast mode
+/// only uses the rounded average, High also tries +-1 per channel.
+static int BaseCandidates(const int *avg, int max, Quality quality,
+                          int (*out)[3]) {
+  int q[3];
+  for (int c = 0; c < 3; c++)
+    q[c] = (avg[c] * max + 127) / 255;
+  if (quality == Fast) {
+    out[0][0] = q[0];
+    out[0][1] = q[1];
+    out[0][2] = q[2];
+    return 1;
+  }
+  int n = 0;
+  for (int r = -1; r <= 1; r++) {
+    for (int g = -1; g <= 1; g++) {
+      for (int b = -1; b <= 1; b++) {
+        int cand[3] = {q[0] + r, q[1] + g, q[2] + b};
+        if (cand[0] < 0 || cand[1] < 0 || cand[2] < 0 || cand[0] > max ||
+            cand[1] > max || cand[2] > max)
+          continue;
+        out[n][0] = cand[0];
+        out[n][1] = cand[1];
+        out[n][2] = cand[2];
+        n++;
+      }
+    }
+  }
+  return n;
+}
+
+static uint64_t PackSelectors(const SubBlockFit *fit, const int (*idx)[8]) {
+  uint64_t bits = 0;
+  for (int s = 0; s < 2; s++) {
+    for (int i = 0; i < 8; i++) {
+      int p = idx[s][i], sel = fit[s].selectors[i];
+      bits |= (uint64_t)(sel >> 1) << (16 + p);
+      bits |= (uint64_t)(sel & 1) << p;
+    }
+  }
+  return bits;
+}
+
+/// Encode one block, returns the 64 bit ETC1 word
+static uint64_t EncodeBlock(const Block &blk, Quality quality) {
+  uint64_t best = 0;
+  int best_error = INT_MAX;
+  int cand[2][27][3];
+  int base[3];
+
+  for (int flip = 0; flip < 2; flip++) {
+    const int(*idx)[8] = SUB_BLOCKS.idx[flip];
+    int avg[2][3];
+    for (int s = 0; s < 2; s++) {
+      for (int c = 0; c < 3; c++) {
+        int sum = 0;
+        for (int i = 0; i < 8; i++)
+          sum += blk.px[idx[s][i]][c];
+        avg[s][c] = (sum + 4) / 8;
+      }
+    }
+
+    // Individual mode, 4 bit base colors
+    SubBlockFit ind[2];
+    int ind_q[2][3];
+    for (int s = 0; s < 2; s++) {
+      int n = BaseCandidates(avg[s], 15, quality, cand[s]);
+      for (int k = 0; k < n; k++) {
+        SubBlockFit fit;
+        fit.error = ind[s].error;
+        for (int c = 0; c < 3; c++)
+          base[c] = Expand4(cand[s][k][c]);
+        FitSubBlock(blk, idx[s], base, quality, &fit);
+        if (fit.error < ind[s].error) {
+          ind[s] = fit;
+          for (int c = 0; c < 3; c++)
+            ind_q[s][c] = cand[s][k][c];
+        }
+      }
+    }
+    if (ind[0].error + ind[1].error < best_error) {
+      best_error = ind[0].error + ind[1].error;
+      best = ((uint64_t)ind_q[0][0] << 60) | ((uint64_t)ind_q[1][0] << 56) |
+             ((uint64_t)ind_q[0][1] << 52) | ((uint64_t)ind_q[1][1] << 48) |
+             ((uint64_t)ind_q[0][2] << 44) | ((uint64_t)ind_q[1][2] << 40) |
+             ((uint64_t)ind[0].table << 37) | ((uint64_t)ind[1].table << 34) |
+             ((uint64_t)flip << 32) | PackSelectors(ind, idx);
+    }
+
+    // Differential mode, 5 bit base plus 3 bit signed delta
+    SubBlockFit fits[2][27];
+    int n[2];
+    for (int s = 0; s < 2; s++) {
+      n[s] = BaseCandidates(avg[s], 31, quality, cand[s]);
+      for (int k = 0; k < n[s]; k++) {
+        for (int c = 0; c < 3; c++)
+          base[c] = Expand5(cand[s][k][c]);
+        FitSubBlock(blk, idx[s], base, quality, &fits[s][k]);
+      }
+    }
+    for (int k0 = 0; k0 < n[0]; k0++) {
+      for (int k1 = 0; k1 < n[1]; k1++) {
+        int err = fits[0][k0].error + fits[1][k1].error;
+        if (err >= best_error)
+          continue;
+        int d[3];
+        bool valid = true;
+        for (int c = 0; c < 3; c++) {
+          d[c] = cand[1][k1][c] - cand[0][k0][c];
+          valid = valid && d[c] >= -4 && d[c] <= 3;
+        }
+        if (!valid)
+          continue;
+        SubBlockFit pair[2] = {fits[0][k0], fits[1][k1]};
+        best_error = err;
+        best = ((uint64_t)cand[0][k0][0] << 59) |
+               ((uint64_t)(d[0] & 7) << 56) |
+               ((uint64_t)cand[0][k0][1] << 51) |
+               ((uint64_t)(d[1] & 7) << 48) |
+               ((uint64_t)cand[0][k0][2] << 43) |
+               ((uint64_t)(d[2] & 7) << 40) | ((uint64_t)pair[0].table << 37) |
+               ((uint64_t)pair[1].table << 34) | (1ULL << 33) |
+               ((uint64_t)flip << 32) | PackSelectors(pair, idx);
+      }
+    }
+  }
+  return best;
+}
+
+static void DecodeBlock(uint64_t word, Block *blk) {
+  int flip = (word >> 32) & 1;
+  int base[2][3];
+  if ((word >> 33) & 1) {
+    for (int c = 0; c < 3; c++) {
+      int shift = 59 - c * 8;
+      int b = (word >> shift) & 31;
+      int d = (word >> (shift - 3)) & 7;
+      d = d >= 4 ? d - 8 : d;
+      base[0][c] = Expand5(b);
+      base[1][c] = Expand5(b + d);
+    }
+  } else {
+    for (int c = 0; c < 3; c++) {
+      base[0][c] = Expand4((word >> (60 - c * 8)) & 15);
+      base[1][c] = Expand4((word >> (56 - c * 8)) & 15);
+    }
+  }
+  int table[2] = {(int)((word >> 37) & 7), (int)((word >> 34) & 7)};
+  for (int i = 0; i < 16; i++) {
+    int x = i >> 2, y = i & 3;
+    int s = flip ? (y >= 2) : (x >= 2);
+    int sel = (int)((((word >> (16 + i)) & 1) << 1) | ((word >> i) & 1));
+    int m = Modifier(table[s], sel);
+    for (int c = 0; c < 3; c++)
+      blk->px[i][c] = Clamp(base[s][c] + m);
+  }
+}
+
+static void WriteLE64(unsigned char *dst, uint64_t v) {
+  for (int i = 0; i < 8; i++)
+    dst[i] = (unsigned char)(v >> (i * 8));
+}
+
+static uint64_t ReadLE64(const unsigned char *src) {
+  uint64_t v = 0;
+  for (int i = 0; i < 8; i++)
+    v |= (uint64_t)src[i] << (i * 8);
+  return v;
+}
+
+size_t CompressedSize(unsigned int tex_w, unsigned int tex_h, bool alpha) {
+  return (size_t)tex_w * tex_h / (alpha ? 1 : 2);
+}
+
+void Compress(unsigned char *dst, const unsigned char *rgba,
+              unsigned int width, unsigned int height, unsigned int tex_w,
+              unsigned int tex_h, bool alpha, Quality quality) {
+  // 8x8 tiles in row order, each holding four 4x4 blocks in Z order. On
+  // PICA200 every block is stored little endian, ETC1A4 puts 4 bit alpha of
+  // the block (column major) in front of it.
+  for (unsigned int ty = 0; ty < tex_h; ty += 8) {
+    for (unsigned int tx = 0; tx < tex_w; tx += 8) {
+      for (unsigned int b = 0; b < 4; b++) {
+        unsigned int bx = tx + (b & 1) * 4, by = ty + (b >> 1) * 4;
+        Block blk;
+        uint64_t alpha_bits = 0;
+        for (int i = 0; i < 16; i++) {
+          unsigned int x = bx + (i >> 2), y = by + (i & 3);
+          const unsigned char *p = nullptr;
+          if (x < width && y < height)
+            p = rgba + ((size_t)y * width + x) * 4;
+          for (int c = 0; c < 4; c++)
+            blk.px[i][c] = p ? p[c] : 0;
+          alpha_bits |= (uint64_t)((blk.px[i][3] * 15 + 127) / 255) << (i * 4);
+        }
+        if (alpha) {
+          WriteLE64(dst, alpha_bits);
+          dst += 8;
+        }
+        WriteLE64(dst, EncodeBlock(blk, quality));
+        dst += 8;
+      }
+    }
+  }
+}
+
+void Decompress(unsigned char *rgba, const unsigned char *src,
+                unsigned int width, unsigned int height, unsigned int tex_w,
+                unsigned int tex_h, bool alpha) {
+  for (unsigned int ty = 0; ty < tex_h; ty += 8) {
+    for (unsigned int tx = 0; tx < tex_w; tx += 8) {
+      for (unsigned int b = 0; b < 4; b++) {
+        unsigned int bx = tx + (b & 1) * 4, by = ty + (b >> 1) * 4;
+        uint64_t alpha_bits = ~0ULL;
+        if (alpha) {
+          alpha_bits = ReadLE64(src);
+          src += 8;
+        }
+        Block blk;
+        DecodeBlock(ReadLE64(src), &blk);
+        src += 8;
+        for (int i = 0; i < 16; i++) {
+          unsigned int x = bx + (i >> 2), y = by + (i & 3);
+          if (x >= width || y >= height)
+            continue;
+          unsigned char *p = rgba + ((size_t)y * width + x) * 4;
+          for (int c = 0; c < 3; c++)
+            p[c] = (unsigned char)blk.px[i][c];
+          p[3] = (unsigned char)(((alpha_bits >> (i * 4)) & 15) * 17);
+        }
+      }
+    }
+  }
+}
+
+double PSNR(const unsigned char *a, const unsigned char *b, size_t pixels,
+            bool alpha) {
+  int channels = alpha ? 4 : 3;
+  double sum = 0.0;
+  for (size_t i = 0; i < pixels; i++) {
+    for (int c = 0; c < channels; c++) {
+      double d = (double)a[i * 4 + c] - (double)b[i * 4 + c];
+      sum += d * d;
+    }
+  }
+  if (sum == 0.0)
+    return INFINITY;
+  double mse = sum / ((double)pixels * channels);
+  return 10.0 * std::log10(255.0 * 255.0 / mse);
+}
+} // namespace ETC1
+} // namespace ProRender
@@ -0,0 +1,50 @@
+/**____            ____                _
+ *|  _ \ _ __ ___ |  _ \ ___ _ __   __| | ___ _ __
+ *| |_) | '__/ _ \| |_) / _ \ '_ \ / _` |/ _ \ '__|
+ *|  __/| | | (_) |  _ <  __/ | | | (_| |  __/ |
+ *|_|   |_|  \___/|_| \_\___|_| |_|\__,_|\___|_|
+ *
+ * _   _ ____ ___      ____ _____
+ *| \ | |  _ \_ _|    |  _ \___  |
+ *|  \| | |_) | |_____| | | | / /
+ *| |\  |  __/| |_____| |_| |/ /
+ *|_| \_|_|  |___|    |____//_/
+ *
+ *  C2D Render Helper - ETC1 Encoder
+ *  Copyright (C) 2023 NPI-D7
+ */
+
+#pragma once
+// Only depends on the C++ standard library, so asset tools can build this
+// on the host together with prorender_etc1.cpp.
+
+#include <cstddef>
+
+namespace ProRender {
+namespace ETC1 {
+enum Quality {
+  Fast = 0, //< Base colors from the subblock averages, for runtime use
+  High = 1  //< Also searches the neighbouring base colors, for asset tools
+};
+
+/// Bytes needed for a tex_w x tex_h texture (ETC1A4 when alpha is set)
+size_t CompressedSize(unsigned int tex_w, unsigned int tex_h, bool alpha);
+
+/// Compress a width x height RGBA8 image into the tiled PICA200 layout of a
+/// tex_w x tex_h ETC1 (or ETC1A4) texture. Texture sizes have to be multiples
+/// of 8, the area outside the image is transparent black.
+void Compress(unsigned char *dst, const unsigned char *rgba,
+              unsigned int width, unsigned int height, unsigned int tex_w,
+              unsigned int tex_h, bool alpha, Quality quality = Fast);
+
+/// Decode the width x height image part of a compressed texture to RGBA8
+void Decompress(unsigned char *rgba, const unsigned char *src,
+                unsigned int width, unsigned int height, unsigned int tex_w,
+                unsigned int tex_h, bool alpha);
+
+/// Peak signal to noise ratio in dB of two RGBA8 images of `pixels` pixels,
+/// alpha is only compared when set
+double PSNR(const unsigned char *a, const unsigned char *b, size_t pixels,
+            bool alpha);
+} // namespace ETC1
+} // namespace ProRender
@@ -0,0 +1,172 @@
+/**____            ____                _
+ *|  _ \ _ __ ___ |  _ \ ___ _ __   __| | ___ _ __
+ *| |_) | '__/ _ \| |_) / _ \ '_ \ / _` |/ _ \ '__|
+ *|  __/| | | (_) |  _ <  __/ | | | (_| |  __/ |
+ *|_|   |_|  \___/|_| \_\___|_| |_|\__,_|\___|_|
+ *
+ * _   _ ____ ___      ____ _____
+ *| \ | |  _ \_ _|    |  _ \___  |
+ *|  \| | |_) | |_____| | | | / /
+ *| |\  |  __/| |_____| |_| |/ /
+ *|_| \_|_|  |___|    |____//_/
+ *
+ *  C2D Render Helper - Texture Swizzling
+ *  Copyright (C) 2023 NPI-D7
+ */
+
+#pragma once
+// Linear to tiled texture layout of the PICA200. Only depends on the C++
+// standard library, so it can be built and tested on the host.
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+
+namespace ProRender {
+namespace Swizzle {
+/// Morton offset of a pixel inside its 8x8 tile
+constexpr unsigned int TileMorton(unsigned int x, unsigned int y) {
+  return ((x & 1) | ((y & 1) << 1) | ((x & 2) << 1) | ((y & 2) << 2) |
+          ((x & 4) << 2) | ((y & 4) << 3));
+}
+
+/// Offset tables for the tiled texture layout. The texel offset of (x, y)
+/// is `strip(y) | row[y & 7] | col[x]`, which never overlap as long as the
+/// texture width is a power of two.
+struct SwizzleTable {
+  constexpr SwizzleTable() : col(), row() {
+    for (unsigned int x = 0; x < 1024; x++)
+      col[x] = (std::uint16_t)(((x >> 3) << 6) | TileMorton(x, 0));
+    for (unsigned int y = 0; y < 8; y++)
+      row[y] = (std::uint8_t)TileMorton(0, y);
+  }
+
+  std::uint16_t col[1024];
+  std::uint8_t row[8];
+};
+
+inline constexpr SwizzleTable SWIZZLE_TABLE;
+
+/// Stores one texel. 4 and 3 byte pixels come in as RGBA/RGB and get
+/// reversed to the GPU byte order, smaller ones are already packed.
+template <unsigned int PixelSize> struct Texel {
+  static inline void Store(unsigned char *dst, const unsigned char *src) {
+    memcpy(dst, src, PixelSize);
+  }
+};
+
+template <> struct Texel<4> {
+  static inline void Store(unsigned char *dst, const unsigned char *src) {
+    std::uint32_t v;
+    memcpy(&v, src, 4);
+    v = __builtin_bswap32(v);
+    memcpy(dst, &v, 4);
+  }
+};
+
+template <> struct Texel<3> {
+  static inline void Store(unsigned char *dst, const unsigned char *src) {
+    dst[0] = src[2];
+    dst[1] = src[1];
+    dst[2] = src[0];
+  }
+};
+
+/// Swizzle a linear image into the tiled GPU layout one 8x8 tile at a time
+template <unsigned int PixelSize>
+inline void SwizzleImage(unsigned char *dst, const unsigned char *src,
+                         unsigned int width, unsigned int height,
+                         unsigned int w_pow2) {
+  const std::uint16_t *col = SWIZZLE_TABLE.col;
+  const std::uint8_t *row = SWIZZLE_TABLE.row;
+  const unsigned int pitch = width * PixelSize;
+
+  for (unsigned int ty = 0; ty < height; ty += 8) {
+    unsigned int th = std::min(8u, height - ty);
+    unsigned int strip = ty * w_pow2;
+    for (unsigned int tx = 0; tx < width; tx += 8) {
+      unsigned int tw = std::min(8u, width - tx);
+      const unsigned char *line = src + ty * pitch + tx * PixelSize;
+      if (tw == 8 && th == 8) {
+        // Full tile, fixed trip count so the compiler can unroll
+        for (unsigned int y = 0; y < 8; y++, line += pitch) {
+          unsigned int r = strip | row[y];
+          for (unsigned int x = 0; x < 8; x++) {
+            Texel<PixelSize>::Store(dst + (r | col[tx + x]) * PixelSize,
+                                    line + x * PixelSize);
+          }
+        }
+      } else {
+        for (unsigned int y = 0; y < th; y++, line += pitch) {
+          unsigned int r = strip | row[y];
+          for (unsigned int x = 0; x < tw; x++) {
+            Texel<PixelSize>::Store(dst + (r | col[tx + x]) * PixelSize,
+                                    line + x * PixelSize);
+          }
+        }
+      }
+    }
+  }
+}
+
+inline void SwizzleImage(unsigned int pixel_size, unsigned char *dst,
+                         const unsigned char *src, unsigned int width,
+                         unsigned int height, unsigned int w_pow2) {
+  switch (pixel_size) {
+  case 4: // GPU_RGBA8
+    SwizzleImage<4>(dst, src, width, height, w_pow2);
+    break;
+  case 3: // GPU_RGB8
+    SwizzleImage<3>(dst, src, width, height, w_pow2);
+    break;
+  case 2: // GPU_RGB565, GPU_RGBA5551, GPU_RGBA4, GPU_LA8
+    SwizzleImage<2>(dst, src, width, height, w_pow2);
+    break;
+  case 1: // GPU_L8, GPU_A8
+    SwizzleImage<1>(dst, src, width, height, w_pow2);
+    break;
+  }
+}
+
+/// Swizzle a width x height rect with any source pitch to (dst_x, dst_y)
+/// of a texture. Slower than SwizzleImage but not bound to tile borders.
+template <unsigned int PixelSize>
+inline void SwizzleRect(unsigned char *dst, const unsigned char *src,
+                        unsigned int src_pitch, unsigned int width,
+                        unsigned int height, unsigned int w_pow2,
+                        unsigned int dst_x, unsigned int dst_y) {
+  const std::uint16_t *col = SWIZZLE_TABLE.col + dst_x;
+  const std::uint8_t *row = SWIZZLE_TABLE.row;
+
+  for (unsigned int y = 0; y < height; y++, src += src_pitch) {
+    unsigned int ty = dst_y + y;
+    unsigned int r = ((ty & ~7u) * w_pow2) | row[ty & 7];
+    for (unsigned int x = 0; x < width; x++) {
+      Texel<PixelSize>::Store(dst + (r | col[x]) * PixelSize,
+                              src + x * PixelSize);
+    }
+  }
+}
+
+inline void SwizzleRect(unsigned int pixel_size, unsigned char *dst,
+                        const unsigned char *src, unsigned int src_pitch,
+                        unsigned int width, unsigned int height,
+                        unsigned int w_pow2, unsigned int dst_x,
+                        unsigned int dst_y) {
+  switch (pixel_size) {
+  case 4:
+    SwizzleRect<4>(dst, src, src_pitch, width, height, w_pow2, dst_x, dst_y);
+    break;
+  case 3:
+    SwizzleRect<3>(dst, src, src_pitch, width, height, w_pow2, dst_x, dst_y);
+    break;
+  case 2:
+    SwizzleRect<2>(dst, src, src_pitch, width, height, w_pow2, dst_x, dst_y);
+    break;
+  case 1:
+    SwizzleRect<1>(dst, src, src_pitch, width, height, w_pow2, dst_x, dst_y);
+    break;
+  }
+}
+} // namespace Swizzle
+} // namespace ProRender
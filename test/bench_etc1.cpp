@@ -0,0 +1,55 @@
+// ETC1 encoder throughput and quality on the sample icon and a 512x512 ramp
+#include "common.hpp"
+
+#include <prorender_etc1.hpp>
+
+#define STB_IMAGE_IMPLEMENTATION
+#include <stb_image.h>
+
+#include <cstdio>
+
+using namespace ProRender;
+
+static void Run(const char *name, const unsigned char *rgba, unsigned int w,
+                unsigned int h) {
+  unsigned int tex_w = Pow2(w), tex_h = Pow2(h);
+  for (int alpha = 0; alpha < 2; alpha++) {
+    std::vector<unsigned char> tex(ETC1::CompressedSize(tex_w, tex_h, alpha));
+    std::vector<unsigned char> decoded((size_t)w * h * 4);
+    for (ETC1::Quality quality : {ETC1::Fast, ETC1::High}) {
+      double us = TimeUs([&] {
+        ETC1::Compress(tex.data(), rgba, w, h, tex_w, tex_h, alpha, quality);
+      });
+      ETC1::Decompress(decoded.data(), tex.data(), w, h, tex_w, tex_h, alpha);
+      double psnr = ETC1::PSNR(rgba, decoded.data(), (size_t)w * h, alpha);
+      printf("%-10s %4ux%-4u %-6s %-4s %9.1f us %8.2f MPix/s %6.2f dB\n",
+             name, w, h, alpha ? "ETC1A4" : "ETC1",
+             quality == ETC1::Fast ? "fast" : "high", us, w * h / us, psnr);
+    }
+  }
+}
+
+int main(int argc, char **argv) {
+  const char *path = argc > 1 ? argv[1] : "../sample/romfs/icon.png";
+  int w, h, c;
+  unsigned char *icon = stbi_load(path, &w, &h, &c, 4);
+  if (icon) {
+    Run("icon.png", icon, (unsigned int)w, (unsigned int)h);
+    stbi_image_free(icon);
+  } else {
+    printf("could not load %s, skipping it\n", path);
+  }
+
+  std::vector<unsigned char> ramp(512 * 512 * 4);
+  for (unsigned int y = 0; y < 512; y++) {
+    for (unsigned int x = 0; x < 512; x++) {
+      unsigned char *p = &ramp[((size_t)y * 512 + x) * 4];
+      p[0] = (unsigned char)(x / 2);
+      p[1] = (unsigned char)(y / 2);
+      p[2] = (unsigned char)((x ^ y) & 0xC0);
+      p[3] = (unsigned char)((x + y) / 4);
+    }
+  }
+  Run("ramp", ramp.data(), 512, 512);
+  return 0;
+}
@@ -0,0 +1,67 @@
+// Host side helpers shared by the tests and benchmarks
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+/// Baseline conversion ConvertImage did before the swizzle rewrite: reverse
+/// the bytes of every pixel in place, then copy pixel by pixel to its Morton
+/// offset. Reversing is a no-op for pixel sizes below 3, as then.
+inline void ReferenceSwizzle(unsigned char *dst, unsigned char *buf,
+                             unsigned int pixel_size, unsigned int width,
+                             unsigned int height, unsigned int w_pow2) {
+  if (pixel_size >= 3) {
+    for (unsigned int i = 0; i < width * height; i++) {
+      unsigned char *p = buf + i * pixel_size;
+      for (unsigned int a = 0, b = pixel_size - 1; a < b; a++, b--) {
+        unsigned char t = p[a];
+        p[a] = p[b];
+        p[b] = t;
+      }
+    }
+  }
+  for (unsigned int x = 0; x < width; x++) {
+    for (unsigned int y = 0; y < height; y++) {
+      unsigned int dst_pos =
+          ((((y >> 3) * (w_pow2 >> 3) + (x >> 3)) << 6) +
+           ((x & 1) | ((y & 1) << 1) | ((x & 2) << 1) | ((y & 2) << 2) |
+            ((x & 4) << 2) | ((y & 4) << 3))) *
+          pixel_size;
+      memcpy(dst + dst_pos, buf + (y * width + x) * pixel_size, pixel_size);
+    }
+  }
+}
+
+inline unsigned int Pow2(unsigned int v) {
+  unsigned int p = 64;
+  while (p < v)
+    p <<= 1;
+  return p;
+}
+
+/// Deterministic pseudo random bytes
+inline std::vector<unsigned char> RandomBytes(size_t n, uint32_t seed) {
+  std::vector<unsigned char> v(n);
+  for (auto &b : v) {
+    seed = seed * 1664525u + 1013904223u;
+    b = (unsigned char)(seed >> 24);
+  }
+  return v;
+}
+
+/// Microseconds per call of `func`, run for roughly 200 ms
+template <typename F> double TimeUs(F func) {
+  using Clock = std::chrono::steady_clock;
+  unsigned int runs = 0;
+  auto start = Clock::now();
+  double elapsed = 0;
+  do {
+    func();
+    runs++;
+    elapsed = std::chrono::duration<double, std::micro>(Clock::now() - start)
+                  .count();
+  } while (elapsed < 200000.0);
+  return elapsed / runs;
+}
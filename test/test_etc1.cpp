@@ -0,0 +1,104 @@
+// Round trip quality of the ETC1 / ETC1A4 encoder
+#include "common.hpp"
+
+#include <prorender_etc1.hpp>
+
+#include <cstdio>
+#include <cstdlib>
+
+using namespace ProRender;
+
+static int failed = 0;
+
+static void Expect(bool ok, const char *what) {
+  if (!ok) {
+    printf("FAIL %s\n", what);
+    failed++;
+  }
+}
+
+/// Smooth color ramps with a few hard edges, like UI art
+static std::vector<unsigned char> MakeImage(unsigned int w, unsigned int h) {
+  std::vector<unsigned char> rgba((size_t)w * h * 4);
+  for (unsigned int y = 0; y < h; y++) {
+    for (unsigned int x = 0; x < w; x++) {
+      unsigned char *p = &rgba[((size_t)y * w + x) * 4];
+      bool edge = ((x / 24) + (y / 24)) & 1;
+      p[0] = (unsigned char)(x * 255 / w);
+      p[1] = (unsigned char)(y * 255 / h);
+      p[2] = edge ? 200 : 40;
+      p[3] = (unsigned char)((x + y) * 255 / (w + h));
+    }
+  }
+  return rgba;
+}
+
+static double RoundTrip(const std::vector<unsigned char> &rgba, unsigned int w,
+                        unsigned int h, bool alpha, ETC1::Quality quality,
+                        std::vector<unsigned char> *decoded) {
+  unsigned int tex_w = Pow2(w), tex_h = Pow2(h);
+  std::vector<unsigned char> tex(ETC1::CompressedSize(tex_w, tex_h, alpha));
+  ETC1::Compress(tex.data(), rgba.data(), w, h, tex_w, tex_h, alpha, quality);
+  decoded->assign((size_t)w * h * 4, 0);
+  ETC1::Decompress(decoded->data(), tex.data(), w, h, tex_w, tex_h, alpha);
+  return ETC1::PSNR(rgba.data(), decoded->data(), (size_t)w * h, alpha);
+}
+
+int main() {
+  Expect(ETC1::CompressedSize(64, 64, false) == 64 * 64 / 2, "ETC1 size");
+  Expect(ETC1::CompressedSize(64, 64, true) == 64 * 64, "ETC1A4 size");
+
+  std::vector<unsigned char> decoded;
+
+  // A flat color only loses the base color rounding and the smallest
+  // modifier
+  std::vector<unsigned char> flat(64 * 64 * 4);
+  for (size_t i = 0; i < flat.size(); i += 4) {
+    flat[i] = 93;
+    flat[i + 1] = 171;
+    flat[i + 2] = 12;
+    flat[i + 3] = 255;
+  }
+  Expect(RoundTrip(flat, 64, 64, false, ETC1::Fast, &decoded) > 35.0,
+         "flat color PSNR");
+
+  auto image = MakeImage(100, 60);
+  double fast = RoundTrip(image, 100, 60, false, ETC1::Fast, &decoded);
+  double high = RoundTrip(image, 100, 60, false, ETC1::High, &decoded);
+  printf("etc1: ramp PSNR fast %.2f dB, high %.2f dB\n", fast, high);
+  Expect(fast > 30.0, "ramp PSNR fast");
+  Expect(high >= fast, "high quality is not worse than fast");
+
+  // ETC1A4 keeps 4 bit alpha, which is off by at most half a step
+  RoundTrip(image, 100, 60, true, ETC1::Fast, &decoded);
+  int max_alpha_err = 0;
+  for (size_t i = 3; i < decoded.size(); i += 4)
+    max_alpha_err = std::max(max_alpha_err, abs(decoded[i] - image[i]));
+  Expect(max_alpha_err <= 8, "ETC1A4 alpha error");
+
+  // Texels outside the image are transparent, the color stays within the
+  // smallest modifier of black
+  unsigned int tex_w = Pow2(100), tex_h = Pow2(60);
+  std::vector<unsigned char> tex(ETC1::CompressedSize(tex_w, tex_h, true));
+  ETC1::Compress(tex.data(), image.data(), 100, 60, tex_w, tex_h, true);
+  std::vector<unsigned char> full((size_t)tex_w * tex_h * 4);
+  ETC1::Decompress(full.data(), tex.data(), tex_w, tex_h, tex_w, tex_h, true);
+  bool outside_clear = true;
+  for (unsigned int y = 0; y < tex_h; y++) {
+    for (unsigned int x = 0; x < tex_w; x++) {
+      if (x < 100 && y < 60)
+        continue;
+      const unsigned char *p = &full[((size_t)y * tex_w + x) * 4];
+      if (p[0] > 2 || p[1] > 2 || p[2] > 2 || p[3])
+        outside_clear = false;
+    }
+  }
+  Expect(outside_clear, "area outside the image is transparent");
+
+  if (failed) {
+    printf("%d ETC1 checks failed\n", failed);
+    return 1;
+  }
+  printf("etc1: all checks passed\n");
+  return 0;
+}
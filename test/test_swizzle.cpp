@@ -0,0 +1,88 @@
+// Bit exactness of the tiled swizzle against the baseline per pixel code
+#include "common.hpp"
+
+#include <prorender_swizzle.hpp>
+
+#include <cstdio>
+
+using namespace ProRender::Swizzle;
+
+template <unsigned int PixelSize>
+static bool CheckImage(unsigned int width, unsigned int height) {
+  unsigned int w_pow2 = Pow2(width), h_pow2 = Pow2(height);
+  size_t tex_size = (size_t)w_pow2 * h_pow2 * PixelSize;
+  auto src = RandomBytes((size_t)width * height * PixelSize, width * height);
+  std::vector<unsigned char> ref(tex_size, 0), out(tex_size, 0);
+  std::vector<unsigned char> scratch = src;
+  ReferenceSwizzle(ref.data(), scratch.data(), PixelSize, width, height,
+                   w_pow2);
+  SwizzleImage<PixelSize>(out.data(), src.data(), width, height, w_pow2);
+  if (ref != out) {
+    printf("FAIL SwizzleImage<%u> %ux%u\n", PixelSize, width, height);
+    return false;
+  }
+  return true;
+}
+
+/// A rect placed at (dst_x, dst_y) of a texture must land where the same
+/// pixels of a full image would
+template <unsigned int PixelSize>
+static bool CheckRect(unsigned int dst_x, unsigned int dst_y,
+                      unsigned int width, unsigned int height) {
+  unsigned int full_w = dst_x + width, full_h = dst_y + height;
+  unsigned int w_pow2 = Pow2(full_w), h_pow2 = Pow2(full_h);
+  size_t tex_size = (size_t)w_pow2 * h_pow2 * PixelSize;
+  auto full = RandomBytes((size_t)full_w * full_h * PixelSize, full_w);
+  std::vector<unsigned char> ref(tex_size, 0), out(tex_size, 0);
+  std::vector<unsigned char> scratch = full;
+  ReferenceSwizzle(ref.data(), scratch.data(), PixelSize, full_w, full_h,
+                   w_pow2);
+  // Rows above and columns left of the rect come from a full swizzle
+  SwizzleImage<PixelSize>(out.data(), full.data(), full_w, full_h, w_pow2);
+  std::vector<unsigned char> cleared(tex_size, 0);
+  for (unsigned int y = 0; y < height; y++) {
+    for (unsigned int x = 0; x < width; x++) {
+      unsigned int tx = dst_x + x, ty = dst_y + y;
+      size_t off = ((size_t)((ty & ~7u) * w_pow2) | SWIZZLE_TABLE.row[ty & 7] |
+                    SWIZZLE_TABLE.col[tx]) *
+                   PixelSize;
+      memset(&out[off], 0, PixelSize);
+    }
+  }
+  size_t pitch = (size_t)full_w * PixelSize;
+  SwizzleRect<PixelSize>(out.data(),
+                         full.data() + dst_y * pitch + dst_x * PixelSize,
+                         (unsigned int)pitch, width, height, w_pow2, dst_x,
+                         dst_y);
+  if (ref != out) {
+    printf("FAIL SwizzleRect<%u> %ux%u at %u,%u\n", PixelSize, width, height,
+           dst_x, dst_y);
+    return false;
+  }
+  return true;
+}
+
+template <unsigned int PixelSize> static int CheckPixelSize() {
+  static const unsigned int sizes[][2] = {
+      {1, 1},     {7, 9},     {8, 8},   {64, 64},    {100, 37},
+      {300, 200}, {1024, 8},  {8, 1024}, {1024, 1024}};
+  int failed = 0;
+  for (auto &s : sizes)
+    failed += !CheckImage<PixelSize>(s[0], s[1]);
+  failed += !CheckRect<PixelSize>(0, 0, 16, 16);
+  failed += !CheckRect<PixelSize>(13, 7, 20, 20);
+  failed += !CheckRect<PixelSize>(56, 3, 1, 1);
+  failed += !CheckRect<PixelSize>(100, 50, 300, 3);
+  return failed;
+}
+
+int main() {
+  int failed = CheckPixelSize<4>() + CheckPixelSize<3>() +
+               CheckPixelSize<2>() + CheckPixelSize<1>();
+  if (failed) {
+    printf("%d swizzle checks failed\n", failed);
+    return 1;
+  }
+  printf("swizzle: all checks passed\n");
+  return 0;
+}